@@ -11,9 +11,11 @@ CFLAGS="\
 : "${CC:=cc}"
 : "${PREFIX:=/usr/local}"
 : "${OS:=$(uname)}"
+: "${SCENARIOS:=load scroll search subst global insert paste undo hl}"
 case "$OS" in
 	*BSD*)		CFLAGS="$CFLAGS -D_BSD_SOURCE"		;;
 	*Darwin*)	CFLAGS="$CFLAGS -D_DARWIN_C_SOURCE"	;;
+	*Linux*)	CFLAGS="$CFLAGS -D_DEFAULT_SOURCE"	;;
 esac
 
 run() {
@@ -35,6 +37,12 @@ debug() {
 	run "$CC vi.c -o vi -O0 -g $CFLAGS"
 }
 
+# build and run the regex conformance and throughput driver
+retest() {
+	run "$CC retest.c -o retest -O2 $CFLAGS"
+	./retest "$@"
+}
+
 pgobuild() {
 	ccversion="$($CC --version)"
 	case "$ccversion" in *clang*) clang=1 ;; esac
@@ -47,12 +55,114 @@ pgobuild() {
 		[ -z "$PROFDATA" ] && echo "pgobuild with clang requires llvm-profdata" && exit 1
 	fi
 	run "$CC vi.c -fprofile-generate=. -o vi -O2 $CFLAGS"
-	echo "qq" | ./vi -v ./vi.c >/dev/null
+	scenarios >/dev/null
 	[ "$clang" = 1 ] && run "$PROFDATA" merge ./*.profraw -o default.profdata
 	run "$CC vi.c -fprofile-use=. -o vi -O2 $CFLAGS"
 	rm -f ./*.gcda ./*.profraw ./default.profdata
 }
 
+# print keys $1 repeated $2 times
+rep() {
+	r=0
+	while [ "$r" -lt "$2" ]; do
+		printf "$1"
+		r=$((r + 1))
+	done
+}
+
+# keystroke script of the benchmark scenario $1
+scenario() {
+	case "$1" in
+	load)	printf 'G' ;;
+	scroll)	rep '\006' 200; rep '\002' 200; rep '\005' 300; rep '\031' 300; rep '\004\025' 100 ;;
+	search)	printf '/int\n'; rep 'n' 300; rep 'N' 300; printf '/[a-z]+_[a-z]+\\(\n'; rep 'n' 20 ;;
+	subst)	printf ':%%s/int/long/g\n:%%s/([a-z])([0-9])/\\2\\1/g\nuu' ;;
+	global)	printf ':g/static/d\nu:g/^$/s/^/-/\nu:g!/;/s/a/A/g\nu' ;;
+	insert)	printf ':se ai\n'; rep 'Oif (x) {\nint i = 0;\nfor (; i < n; i++)\nf(i);\n\033' 300 ;;
+	paste)	printf 'Go\033[200~'; rep 'abcdefghijklmnopqrstuvwxyz 0123456789\n' 20000; printf '\033[201~\033' ;;
+	undo)	rep 'x' 300; rep 'u' 300; rep '\022' 300; rep 'ddp' 200; rep 'u' 400 ;;
+	regex)	printf '/(a|aa)+b\n'; rep 'n' 50; printf ':%%s/(a*)*c/x/g\nu' ;;
+	hl)	printf ':se hll|se hlw|se hlp\n'; rep 'jwwl' 400; rep '\004' 20 ;;
+	*)	echo "unknown scenario: $1" >&2; exit 1 ;;
+	esac
+	printf ':q!\n'
+}
+
+# replay the scenarios in $SCENARIOS on a large file; report times and counters
+scenarios() {
+	dir="$(mktemp -d)"
+	for i in 1 2 3 4 5 6 7 8; do cat vi.c; done >"$dir/bench.c"
+	for s in $SCENARIOS; do
+		scenario "$s" >"$dir/$s.keys"
+		echo "== $s"
+		./vi -bs "$dir/bench.c" <"$dir/$s.keys" 2>&1 >/dev/null
+	done
+	rm -rf "$dir"
+}
+
+bench() {
+	[ -x vi ] || build
+	scenarios
+}
+
+# print the reproducible corpus $1 of size $2
+corpus() {
+	awk -v kind="$1" -v n="$2" '
+	function rnd(m) { seed = seed * 16807 % 2147483647; return seed % m }
+	function words(k, w, nw,   i, s) {
+		for (i = 0; i < k; i++)
+			s = s w[rnd(nw) + 1] " "
+		return s
+	}
+	BEGIN {
+		seed = 1
+		nw = split("int char static return if else for while void struct x y", w, " ")
+		nu = split("\327\251\327\234\327\225\327\235 \330\263\331\204\330\247\331\205 " \
+			"\330\250\331\216\330\252\331\220 \344\270\255\346\226\207 e\314\201t\303\251 " \
+			"\342\200\217abc\342\200\216 hello world", u, " ")
+		if (kind == "lines")		# n lines of C like words
+			for (i = 0; i < n; i++)
+				print words(rnd(12), w, nw) ";"
+		else if (kind == "long")	# 4 lines of n words
+			for (i = 0; i < 4; i++)
+				print words(n, w, nw)
+		else if (kind == "nest") {	# brackets nested n deep
+			for (i = 0; i < n; i++)
+				print "if (" words(2, w, nw) ") {"
+			for (i = 0; i < n; i++)
+				print "} " words(2, w, nw)
+		} else if (kind == "utf8")	# n lines of mixed rtl, wide and combining text
+			for (i = 0; i < n; i++)
+				print words(rnd(8), w, nw) words(rnd(12), u, nu)
+		else if (kind == "regex")	# n lines of a runs, few end in b
+			for (i = 0; i < n; i++) {
+				s = ""
+				for (k = rnd(200); k > 0; k--)
+					s = s "a"
+				print s (rnd(16) ? "" : "b")
+			}
+		else {
+			print "unknown corpus: " kind > "/dev/stderr"
+			exit 1
+		}
+	}'
+}
+
+# time scenarios $3 on corpus $1 of each size in $2
+scaling() {
+	[ -x vi ] || build
+	dir="$(mktemp -d)"
+	for n in ${2:-1000 10000 100000}; do
+		corpus "${1:-lines}" "$n" >"$dir/corpus"
+		for s in ${3:-load search scroll}; do
+			scenario "$s" >"$dir/$s.keys"
+			t="$(./vi -bs "$dir/corpus" <"$dir/$s.keys" 2>&1 >/dev/null | sed -n 's/^time: //p')"
+			printf '%s\t%s\t%s\t%s\n' "${1:-lines}" "$n" "$s" "$t"
+		done
+	done
+	rm -rf "$dir"
+}
+
 if [ "$#" -gt 0 ]; then
 	"$@"
 else
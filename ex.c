@@ -33,6 +33,14 @@ static int xbufsmax;		/* number of buffers */
 static int xbufsalloc = 10;	/* initial number of buffers */
 static char xrep[EXLEN];	/* the last replacement */
 static int xgdep;		/* global command recursion depth */
+static int *bufs_tab;		/* path hash index of bufs[]; idx + 1 or 0 */
+static int bufs_tabsz;		/* size of bufs_tab[], a power of two */
+static int bufs_clock;		/* bufs_switch() count, for buf.lru */
+static struct bufghost {
+	char *path;
+	int row, off, top, td;
+} bufs_ghost[32];		/* positions in recently evicted buffers */
+static int bufs_nghost;		/* number of bufs_ghost[] insertions */
 
 static int rstrcmp(const char *s1, const char *s2, int l1, int l2)
 {
@@ -44,11 +52,47 @@ static int rstrcmp(const char *s1, const char *s2, int l1, int l2)
 	return 0;
 }
 
-static int bufs_find(const char *path, int len)
+static unsigned bufs_hash(const char *path, int len)
+{
+	unsigned h = 2166136261u;
+	while (len--)
+		h = (h ^ (unsigned char) *path++) * 16777619u;
+	return h;
+}
+
+static void bufs_tabadd(int idx)
 {
+	int m = bufs_tabsz - 1;
+	int i = bufs_hash(bufs[idx].path, bufs[idx].plen) & m;
+	while (bufs_tab[i])
+		i = (i + 1) & m;
+	bufs_tab[i] = idx + 1;
+}
+
+/* rebuild the path index of bufs[] */
+static void bufs_reindex(void)
+{
+	int sz = 16;
+	while (sz < xbufsmax * 2)
+		sz *= 2;
+	if (sz != bufs_tabsz) {
+		free(bufs_tab);
+		bufs_tab = emalloc(sz * sizeof(bufs_tab[0]));
+		bufs_tabsz = sz;
+	}
+	memset(bufs_tab, 0, sz * sizeof(bufs_tab[0]));
 	for (int i = 0; i < xbufcur; i++)
-		if (!rstrcmp(bufs[i].path, path, bufs[i].plen, len))
-			return i;
+		bufs_tabadd(i);
+}
+
+int bufs_find(const char *path, int len)
+{
+	int m = bufs_tabsz - 1, i;
+	for (i = bufs_hash(path, len) & m; bufs_tabsz && bufs_tab[i]; i = (i + 1) & m) {
+		int idx = bufs_tab[i] - 1;
+		if (!rstrcmp(bufs[idx].path, path, bufs[idx].plen, len))
+			return idx;
+	}
 	return -1;
 }
 
@@ -58,6 +102,53 @@ static void bufs_free(int idx)
 	lbuf_free(bufs[idx].lb);
 }
 
+/* the least recently used buffer, unmodified ones first */
+static int bufs_victim(void)
+{
+	int i, mod, v = 0, vmod = lbuf_modified(bufs[0].lb);
+	for (i = 1; i < xbufcur; i++) {
+		mod = lbuf_modified(bufs[i].lb);
+		if (mod < vmod || (mod == vmod && bufs[i].lru < bufs[v].lru)) {
+			v = i;
+			vmod = mod;
+		}
+	}
+	return v;
+}
+
+/* free buffer idx, remembering its position if it is unmodified */
+static void bufs_evict(int idx)
+{
+	struct buf *b = &bufs[idx];
+	if (b->path[0] && !lbuf_modified(b->lb)) {
+		struct bufghost *g = &bufs_ghost[bufs_nghost++ % LEN(bufs_ghost)];
+		free(g->path);
+		g->path = uc_dup(b->path);
+		g->row = ex_buf == b ? xrow : b->row;
+		g->off = ex_buf == b ? xoff : b->off;
+		g->top = ex_buf == b ? xtop : b->top;
+		g->td = ex_buf == b ? xtd : b->td;
+	}
+	bufs_free(idx);
+}
+
+/* restore the position of an evicted buffer */
+static void bufs_unghost(struct buf *b)
+{
+	for (int i = 0; i < LEN(bufs_ghost); i++) {
+		struct bufghost *g = &bufs_ghost[i];
+		if (g->path && !strcmp(g->path, b->path)) {
+			b->row = g->row;
+			b->off = g->off;
+			b->top = g->top;
+			b->td = g->td;
+			free(g->path);
+			g->path = NULL;
+			return;
+		}
+	}
+}
+
 static long mtime(char *path)
 {
 	struct stat st;
@@ -76,16 +167,17 @@ void bufs_switch(int idx)
 			ex_pbuf = ex_buf;
 		ex_buf = &bufs[idx];
 	}
+	bufs[idx].lru = ++bufs_clock;
 	exbuf_load(ex_buf)
 }
 
 static int bufs_open(const char *path, int len)
 {
-	int i = xbufcur;
-	if (i <= xbufsmax - 1)
+	int i = xbufcur, full = xbufcur >= xbufsmax;
+	if (!full)
 		xbufcur++;
 	else
-		bufs_free(--i);
+		bufs_evict(i = bufs_victim());
 	bufs[i].path = uc_dup(path);
 	bufs[i].lb = lbuf_make();
 	bufs[i].plen = len;
@@ -94,6 +186,12 @@ static int bufs_open(const char *path, int len)
 	bufs[i].top = 0;
 	bufs[i].td = +1;
 	bufs[i].mtime = -1;
+	bufs[i].ft = NULL;
+	bufs_unghost(&bufs[i]);
+	if (full)
+		bufs_reindex();
+	else
+		bufs_tabadd(i);
 	return i;
 }
 
@@ -370,6 +468,8 @@ if (fd >= 0) { \
 	errchk lbuf_rd(xb, fd, 0, lbuf_len(xb)); \
 	close(fd); \
 } \
+xrow = MIN(xrow, MAX(0, lbuf_len(xb) - 1)); \
+xtop = MIN(xtop, xrow); \
 
 int ex_edit(const char *path, int len)
 {
@@ -398,8 +498,8 @@ static int ec_edit(char *loc, char *cmd, char *arg)
 		bufs_switchwft(fd)
 		return 0;
 	} else if (xbufcur == xbufsmax && !strchr(cmd, '!') &&
-			lbuf_modified(bufs[xbufsmax - 1].lb)) {
-		ex_show("last buffer modified");
+			lbuf_modified(bufs[bufs_victim()].lb)) {
+		ex_show("buffers modified");
 		return 1;
 	} else if (len || !xbufcur || !strchr(cmd, '!')) {
 		bufs_switch(bufs_open(arg+cd, len));
@@ -417,28 +517,146 @@ static int ec_edit(char *loc, char *cmd, char *arg)
 	return fd < 0 || rd;
 }
 
+/* the index of "ea": the characters in each path of tempbufs[1] and
+ * the paths matching the last query, narrowed while the query grows */
+static unsigned long long *ea_mask;
+static int *ea_cand;
+static int ea_n, ea_ncand, ea_stamp;
+static char *ea_query;
+
+struct eahit {
+	int score, pos;
+};
+
+static unsigned long long ea_bit[256];
+static unsigned char ea_low[256];
+
+static unsigned long long ea_bits(char *s, int n)
+{
+	unsigned long long m = 0;
+	while (n-- > 0)
+		m |= ea_bit[(unsigned char) *s++];
+	return m;
+}
+
+/* the score of q as a subsequence of path ignoring case, or -1; matches
+ * nearer the end, in the basename, after a separator and consecutive
+ * ones score higher, and unmatched basename characters lower */
+static int ea_score(char *path, int len, char *q, int qn)
+{
+	unsigned char *s = (unsigned char *) path;
+	int b, i = len, last = -2, sc, c;
+	for (b = len; b > 0 && path[b - 1] != '/'; b--);
+	sc = b - len;
+	while (qn > 0) {
+		c = ea_low[(unsigned char) q[--qn]];
+		while (--i >= 0 && ea_low[s[i]] != c);
+		if (i < 0)
+			return -1;
+		sc += 1 + (path[i] == q[qn]) + (i >= b) * 3;
+		if (i == b || (i > 0 && strchr("/_-. ", path[i - 1])))
+			sc += 6;
+		if (i + 1 == last)
+			sc += 5;
+		last = i;
+	}
+	return MAX(sc + 1024, 1) * 64 - MIN(len, 63);
+}
+
+static void ea_narrow(char *q)
+{
+	struct lbuf *lb = tempbufs[1].lb;
+	int i, n = 0, qn = strlen(q);
+	unsigned long long m = ea_bits(q, qn);
+	char *path;
+	for (i = ea_low['a'] ? 256 : 0; i < 256; i++) {
+		ea_low[i] = tolower(i);
+		ea_bit[i] = 1ULL << (ea_low[i] >= 'a' && ea_low[i] <= 'z' ?
+			ea_low[i] - 'a' : i >= '0' && i <= '9' ? i - '0' + 26 : i % 28 + 36);
+	}
+	if (ea_stamp != lbuf_stamp(lb)) {
+		ea_n = lbuf_len(lb);
+		free(ea_mask);
+		free(ea_cand);
+		ea_mask = emalloc((ea_n + 1) * sizeof(ea_mask[0]));
+		ea_cand = emalloc((ea_n + 1) * sizeof(ea_cand[0]));
+		for (i = 0; i < ea_n; i++) {
+			path = lbuf_get(lb, i);
+			ea_mask[i] = ea_bits(path, lbuf_slen(path));
+		}
+		ea_stamp = lbuf_stamp(lb);
+		free(ea_query);
+		ea_query = NULL;
+	}
+	if (!ea_query || strncmp(q, ea_query, strlen(ea_query))) {
+		for (i = 0; i < ea_n; i++)
+			ea_cand[i] = i;
+		ea_ncand = ea_n;
+	}
+	for (i = 0; i < ea_ncand; i++) {
+		path = lbuf_get(lb, ea_cand[i]);
+		if ((ea_mask[ea_cand[i]] & m) == m &&
+				ea_score(path, lbuf_slen(path), q, qn) >= 0)
+			ea_cand[n++] = ea_cand[i];
+	}
+	ea_ncand = n;
+	free(ea_query);
+	ea_query = uc_dup(q);
+}
+
+static int ea_cmp(const void *a, const void *b)
+{
+	const struct eahit *x = a, *y = b;
+	return x->score != y->score ? y->score - x->score : x->pos - y->pos;
+}
+
+/* is path's basename containing arg */
+static int ea_sub(char *path, int len, char *arg)
+{
+	int i, ret;
+	for (i = len; i > 0 && path[i] != '/'; i--);
+	if (!i)
+		return 0;
+	path[len] = '\0';
+	ret = strstr(&path[i+1], arg) != NULL;
+	path[len] = '\n';
+	return ret;
+}
+
+/* open the Nth path whose basename contains arg; if there are not that
+ * many, continue with the best fuzzy matches of the other paths */
 static int ec_editapprox(char *loc, char *cmd, char *arg)
 {
-	int len, i, inst;
-	char *path, *arg1;
+	struct eahit *hits;
+	int len, i, inst, n = 0;
+	char *path = NULL, *arg1;
 	arg1 = arg+dstrlen(arg, ' ');
 	inst = atoi(arg1);
 	*arg1 = '\0';
-	for (int pos = 0; pos < lbuf_len(tempbufs[1].lb); pos++) {
-		path = lbuf_get(tempbufs[1].lb, pos);
-		len = lbuf_slen(path);
-		for (i = len; i > 0 && path[i] != '/'; i--);
-		if (!i)
-			continue;
-		path[len] = '\0';
-		if (strstr(&path[i+1], arg)) {
-			if (!inst) {
-				ec_edit(loc, cmd, path);
-				path[len] = '\n';
-				break;
+	ea_narrow(arg);
+	for (i = 0; i < ea_ncand && !path; i++) {
+		path = lbuf_get(tempbufs[1].lb, ea_cand[i]);
+		if (!ea_sub(path, lbuf_slen(path), arg) || inst--)
+			path = NULL;
+	}
+	if (!path && inst >= 0) {
+		hits = emalloc((ea_ncand + 1) * sizeof(hits[0]));
+		for (i = 0; i < ea_ncand; i++) {
+			path = lbuf_get(tempbufs[1].lb, ea_cand[i]);
+			len = lbuf_slen(path);
+			if (!ea_sub(path, len, arg)) {
+				hits[n].score = ea_score(path, len, arg, strlen(arg));
+				hits[n++].pos = ea_cand[i];
 			}
-			inst--;
 		}
+		qsort(hits, n, sizeof(hits[0]), ea_cmp);
+		path = inst < n ? lbuf_get(tempbufs[1].lb, hits[inst].pos) : NULL;
+		free(hits);
+	}
+	if (path) {
+		len = lbuf_slen(path);
+		path[len] = '\0';
+		ec_edit(loc, cmd, path);
 		path[len] = '\n';
 	}
 	return 1;
@@ -449,6 +667,7 @@ static int ec_setpath(char *loc, char *cmd, char *arg)
 	free(ex_path);
 	ex_path = uc_dup(arg);
 	ex_buf->plen = strlen(arg);
+	bufs_reindex();
 	return 0;
 }
 
@@ -704,15 +923,107 @@ static void replace(sbuf *dst, char *rep, char *ln, int *offs)
 	}
 }
 
-static int ec_substitute(char *loc, char *cmd, char *arg)
+/* replace lines [beg, end) with the first n bytes of sb; return the line count change */
+static int ex_subflush(sbuf *sb, int n, int beg, int end)
 {
-	int beg, end, grp = xgrp != 2 ? xgrp : 32;
+	int len = lbuf_len(xb);
+	sbufn_cut(sb, n)
+	lbuf_edit(xb, sb->s, beg, end);
+	sbuf_cut(sb, 0)
+	return lbuf_len(xb) - len;
+}
+
+#define SUBLNS		4096	/* minimum lines per :s worker */
+#define SUBWORKERS	16	/* maximum number of :s workers */
+
+struct subarg {
+	int beg, end, n;
+	int grp, g;
+	rset *only;		/* only lines matching (or with not, not matching) this */
+	int not;
+};
+
+/* append ln with xkwdrs matches replaced by xrep to r; return nonzero if changed */
+static int ex_subln(sbuf *r, char *ln, int *offs, struct subarg *a)
+{
+	int hit = 0, grp = a->grp;
+	if (a->only && (rset_find(a->only, ln, 0, NULL, REG_NEWLINE) < 0) != a->not)
+		return 0;
+	while (rset_find(xkwdrs, ln, grp / 2, offs, REG_NEWLINE) >= 0) {
+		if (offs[xgrp - 2] < 0) {
+			ln += offs[1] > 0 ? offs[1] : 1;
+			continue;
+		}
+		hit = 1;
+		sbuf_mem(r, ln, offs[xgrp - 2])
+		replace(r, xrep, ln, offs);
+		ln += offs[xgrp - 1];
+		if (!offs[xgrp - 1])	/* zero-length match */
+			sbuf_chr(r, (unsigned char)*ln++)
+		if (*ln == '\n' || !*ln || !a->g)
+			break;
+	}
+	if (hit)
+		sbuf_str(r, ln)
+	return hit;
+}
+
+/* substitute the w-th part of the region; out gets the row, length and text of changed lines */
+static void ex_subworker(int w, sbuf *out, void *arg)
+{
+	struct subarg *a = arg;
+	int offs[a->grp], hdr[2];
+	int i = a->beg + (long) (a->end - a->beg) * w / a->n;
+	int end = a->beg + (long) (a->end - a->beg) * (w + 1) / a->n;
+	for (; i < end; i++) {
+		int pos = out->s_n;
+		sbuf_set(out, 0, (int) sizeof(hdr))
+		if (ex_subln(out, lbuf_get(xb, i), offs, a)) {
+			hdr[0] = i;
+			hdr[1] = out->s_n - pos - (int) sizeof(hdr);
+			memcpy(out->s + pos, hdr, sizeof(hdr));
+		} else {
+			sbuf_cut(out, pos)
+		}
+	}
+}
+
+/* check that the records of the workers are in range and in order */
+static int ex_subcheck(struct subarg *a, sbuf **res)
+{
+	int w, pos, last, end, hdr[2];
+	for (w = 0; w < a->n; w++) {
+		last = a->beg + (long) (a->end - a->beg) * w / a->n - 1;
+		end = a->beg + (long) (a->end - a->beg) * (w + 1) / a->n;
+		for (pos = 0; pos < res[w]->s_n; pos += sizeof(hdr) + hdr[1]) {
+			if (res[w]->s_n - pos < (int) sizeof(hdr))
+				return 1;
+			memcpy(hdr, res[w]->s + pos, sizeof(hdr));
+			if (hdr[1] < 0 || hdr[1] > res[w]->s_n - pos - (int) sizeof(hdr))
+				return 1;
+			if (hdr[0] <= last || hdr[0] >= end)
+				return 1;
+			last = hdr[0];
+		}
+	}
+	return 0;
+}
+
+/* substitute in lines [beg, end) selected by only and not; as with one edit
+ * per line, the rows a replacement adds are searched next (skipped with only);
+ * with only, end - 1 should be the last selected line */
+static int ex_subst(int beg, int end, char *arg, rset *only, int not)
+{
+	int grp = xgrp != 2 ? xgrp : 32;
 	int offs[grp];
 	char *pat = NULL, *rep = NULL;
 	char *s = arg;
-	int i, first = -1, last;
-	if (ex_region(loc, &beg, &end))
-		return 1;
+	int i, first = -1, last = 0;
+	int bbeg = -1, blast = 0, blen = 0;	/* the pending batch of edits */
+	sbuf *r, *res[SUBWORKERS];
+	struct subarg sa;
+	int k = 0, pos = 0, sh = 0, hdr[2] = {-1};	/* parallel results cursor */
+	int lnl = 1;	/* lines in the last changed line */
 	pat = re_read(&s);
 	ex_krsset(pat, +1);
 	if (pat && *s) {
@@ -725,39 +1036,92 @@ static int ec_substitute(char *loc, char *cmd, char *arg)
 	free(rep);
 	if (!xkwdrs)
 		return 1;
+	sbuf_make(r, 256)
+	sa.beg = beg;
+	sa.end = end;
+	sa.grp = grp;
+	sa.g = strchr(s, 'g') != NULL;
+	sa.only = only;
+	sa.not = not;
+	sa.n = MIN(MIN(cmd_ncpu(), (end - beg) / SUBLNS), SUBWORKERS);
+	if (sa.n > 1 && (cmd_fork(sa.n, ex_subworker, &sa, res) || ex_subcheck(&sa, res))) {
+		for (i = 0; i < sa.n; i++)	/* a worker failed; do it here */
+			sbuf_free(res[i])
+		sa.n = 1;
+	}
 	for (i = beg; i < end; i++) {
-		char *ln = lbuf_get(xb, i);
-		sbuf *r = NULL;
-		while (rset_find(xkwdrs, ln, grp / 2, offs, REG_NEWLINE) >= 0) {
-			if (offs[xgrp - 2] < 0) {
-				ln += offs[1] > 0 ? offs[1] : 1;
-				continue;
-			} else if (!r)
-				sbuf_make(r, 256)
-			sbuf_mem(r, ln, offs[xgrp - 2])
-			replace(r, xrep, ln, offs);
-			ln += offs[xgrp - 1];
-			if (!offs[xgrp - 1])	/* zero-length match */
-				sbuf_chr(r, (unsigned char)*ln++)
-			if (*ln == '\n' || !*ln || !strchr(s, 'g'))
-				break;
+		int hit, d, o = r->s_n;
+		if (sa.n > 1) {
+			while (k < sa.n && hdr[0] < i - sh) {
+				if (pos < res[k]->s_n) {
+					memcpy(hdr, res[k]->s + pos, sizeof(hdr));
+					pos += sizeof(hdr) + hdr[1];
+				} else {
+					k++;
+					pos = 0;
+				}
+			}
+			if ((hit = hdr[0] == i - sh))
+				sbuf_mem(r, res[k]->s + pos - hdr[1], hdr[1])
+		} else {
+			hit = ex_subln(r, lbuf_get(xb, i), offs, &sa);
 		}
-		if (r) {
+		if (hit) {
 			if (first < 0) {
 				first = i;
-				lbuf_emark(xb, lbuf_opt(xb, NULL, xrow, 0), 0, 0);
+				lbuf_emark(xb, lbuf_opt(xb, NULL, only ? i : xrow, 0), 0, 0);
 			}
-			sbufn_str(r, ln)
-			lbuf_edit(xb, r->s, i, i + 1);
-			sbuf_free(r)
+			if (bbeg < 0)
+				bbeg = i;
+			blast = i;
+			blen = r->s_n;
 			last = i;
-		}
+			for (lnl = 0; o < blen; o++)
+				lnl += r->s[o] == '\n';
+			if (lnl != 1 || r->s[blen - 1] != '\n') {
+				/* the line count changes: end the batch here, so that
+				 * lglob_shift() moves :g marks as for a single line */
+				d = ex_subflush(r, blen, bbeg, i + 1);
+				bbeg = -1;
+				if (only) {	/* the new lines are not selected */
+					i += d;
+					end += d;
+					sh += d;
+				} else if (sa.n > 1) {	/* the next rows are its new lines */
+					for (k = 0; k < sa.n; k++)
+						sbuf_free(res[k])
+					sa.n = 1;
+				}
+			}
+		} else if (bbeg >= 0 && i - blast > 64) {
+			/* long unchanged runs end the batch instead of being copied */
+			ex_subflush(r, blen, bbeg, blast + 1);
+			bbeg = -1;
+		} else if (bbeg >= 0)
+			sbuf_str(r, lbuf_get(xb, i))
+	}
+	if (bbeg >= 0)
+		ex_subflush(r, blen, bbeg, blast + 1);
+	sbuf_free(r)
+	for (i = 0; sa.n > 1 && i < sa.n; i++)
+		sbuf_free(res[i])
+	if (only) {	/* cursor and marks as if each line was substituted alone */
+		xrow = first >= 0 && last + lnl == end ? last : end - 1;
+		first = first >= 0 ? last : first;
 	}
 	if (first >= 0)
 		lbuf_emark(xb, lbuf_opt(xb, NULL, xrow, 0), first, last);
 	return 0;
 }
 
+static int ec_substitute(char *loc, char *cmd, char *arg)
+{
+	int beg, end;
+	if (ex_region(loc, &beg, &end))
+		return 1;
+	return ex_subst(beg, end, arg, NULL, 0);
+}
+
 static int ec_exec(char *loc, char *cmd, char *arg)
 {
 	int beg, end;
@@ -784,6 +1148,7 @@ static int ec_ft(char *loc, char *cmd, char *arg)
 	ex_ft = syn_setft(arg[0] ? arg : ex_ft);
 	ex_show(ex_ft);
 	syn_reload = 1;
+	led_overlay(0, -1, 0, 0, 0);
 	return 0;
 }
 
@@ -798,12 +1163,79 @@ static int ec_cmap(char *loc, char *cmd, char *arg)
 	return 0;
 }
 
+/* an ex command parsed once, for running many times */
+struct explan {
+	char *loc, *cmd, *arg;	/* arg is path-expanded */
+	int (*ec)(char *loc, char *cmd, char *arg);	/* NULL if it cannot run */
+};
+
+static struct explan *ex_plan(const char *ln, int *n);
+static int ex_planexec(struct explan *p, int n);
+static void ex_planfree(struct explan *p, int n);
+
+#define GMATCH(i)	((rset_find(rs, lbuf_get(xb, i), 0, NULL, REG_NEWLINE) < 0) == not)
+
+/* delete matching lines in [beg, end) one run at a time; return the line count change */
+static int ex_globruns(rset *rs, int not, int beg, int end)
+{
+	int i, j, n = end;
+	for (i = beg; i < end; i++) {
+		for (j = i; j < end && GMATCH(j); j++)
+			;
+		lbuf_edit(xb, NULL, i, j);
+		end -= j - i;
+	}
+	return end - n;
+}
+
+/* :g/re/d: rewrite runs of matches with short gaps between them in one edit */
+static void ex_globdel(rset *rs, int not, int beg, int end, int reg)
+{
+	int i, d, del = 0, bbeg = -1, blast = 0, blen = 0;
+	int dl[9], ndl = 0;	/* the last deleted lines of the batch */
+	sbuf *sb;
+	sbuf_make(sb, 256)
+	for (i = beg; i <= end; i++) {
+		if (i < end && GMATCH(i)) {
+			if (bbeg < 0)
+				bbeg = i;
+			if (isupper(reg))
+				ex_yank(reg, i, i + 1);
+			else
+				dl[ndl++ % LEN(dl)] = i;
+			blast = i;
+			blen = sb->s_n;
+		} else if (bbeg >= 0 && (i == end || i - blast > 64)) {
+			/* fill the registers as deleting one by one would */
+			for (d = MAX(0, ndl - LEN(dl)); d < ndl; d++)
+				ex_yank(reg, dl[d % LEN(dl)], dl[d % LEN(dl)] + 1);
+			if (lbuf_marked(xb, bbeg, blast + 1)) {
+				sbuf_cut(sb, 0)
+				d = ex_globruns(rs, not, bbeg, blast + 1);
+			} else {
+				d = ex_subflush(sb, blen, bbeg, blast + 1);
+			}
+			xrow = blast + 1 + d;
+			i += d;
+			end += d;
+			bbeg = -1;
+			ndl = 0;
+			del = 1;
+		} else if (bbeg >= 0)
+			sbuf_str(sb, lbuf_get(xb, i))
+	}
+	sbuf_free(sb)
+	if (del)
+		lbuf_emark(xb, lbuf_opt(xb, NULL, xrow, 0), -1, xrow);
+}
+
 static int ec_glob(char *loc, char *cmd, char *arg)
 {
-	int beg, end, not;
+	int beg, end, not, n;
 	char *pat, *s = arg;
 	int i;
 	rset *rs;
+	struct explan *p;
 	if (!loc[0] && !xgdep)
 		loc = "%";
 	if (ex_region(loc, &beg, &end))
@@ -815,25 +1247,37 @@ static int ec_glob(char *loc, char *cmd, char *arg)
 	free(pat);
 	if (!pat || !rs)
 		return 1;
+	p = ex_plan(s, &n);
+	if (n == 1 && !p[0].loc[0] && p[0].ec == ec_delete && lbuf_len(xb)) {
+		ex_globdel(rs, not, beg, end, (unsigned char) p[0].arg[0]);
+		goto done;
+	}
+	if (n == 1 && !p[0].loc[0] && p[0].ec == ec_substitute) {
+		for (i = end - 1; i >= beg && !GMATCH(i); i--)
+			;
+		if (i >= beg && ex_subst(beg, i + 1, p[0].arg, rs, not))
+			for (xrow = beg; !GMATCH(xrow); xrow++)	/* it stops at the first line on failure */
+				;
+		goto done;
+	}
 	xgdep++;
-	for (i = beg + 1; i < end; i++)
-		lbuf_globset(xb, i, xgdep);
+	lbuf_globset(xb, beg + 1, end, xgdep);
 	i = beg;
-	while (i < lbuf_len(xb)) {
+	while (i >= 0 && i < lbuf_len(xb)) {
 		char *ln = lbuf_get(xb, i);
 		if ((rset_find(rs, ln, 0, NULL, REG_NEWLINE) < 0) == not) {
 			xrow = i;
-			if (ex_exec(s))
+			if (ex_planexec(p, n))
 				break;
 			i = MIN(i, xrow);
 		}
-		while (i < lbuf_len(xb) && !lbuf_globget(xb, i, xgdep))
-			i++;
+		i = lbuf_globnext(xb, i, xgdep);
 	}
-	for (i = 0; i < lbuf_len(xb); i++)
-		lbuf_globget(xb, i, xgdep);
-	rset_free(rs);
+	lbuf_globclear(xb, xgdep);
 	xgdep--;
+done:
+	ex_planfree(p, n);
+	rset_free(rs);
 	return 0;
 }
 
@@ -951,6 +1395,7 @@ static int ec_chdir(char *loc, char *cmd, char *arg)
 		bufs[i].path = opath;
 		bufs[i].plen = strlen(opath);
 	}
+	bufs_reindex();
 	return 0;
 	err:
 	ex_show("chdir error");
@@ -979,6 +1424,55 @@ static int ec_setacreg(char *loc, char *cmd, char *arg)
 	return 0;
 }
 
+/* performance counters and phase latency histograms */
+char *ex_perf(void)
+{
+	static char *phases[PF_CNT] = {"cmd", "syn", "draw", "render", "commit", "key", "motion"};
+	char buf[256];
+	int i, j;
+	sbuf *sb;
+	sbuf_make(sb, 1024)
+	snprintf(buf, sizeof(buf), "frames: %ld  writes: %ld  bytes: %ld  "
+			"last frame: %ld writes %ld bytes\n", term_nframes,
+			term_nwrites, term_nbytes, term_fwrites, term_fbytes);
+	sbuf_str(sb, buf)
+	for (i = 0; i < PF_CNT; i++) {
+		snprintf(buf, sizeof(buf), "%-7s", phases[i]);
+		sbuf_str(sb, buf)
+		for (j = 0; j < PF_BKT; j++) {
+			if (!term_hist[i][j])
+				continue;
+			snprintf(buf, sizeof(buf), " <%ldus:%ld", 1L << j, term_hist[i][j]);
+			sbuf_str(sb, buf)
+		}
+		sbuf_chr(sb, '\n')
+	}
+	sbufn_done(sb)
+}
+
+static int ec_perf(char *loc, char *cmd, char *arg)
+{
+	char *r = ex_perf(), *s, *e;
+	int fd;
+	if (*arg) {
+		fd = open(arg, O_WRONLY | O_CREAT | O_TRUNC, conf_mode());
+		if (fd < 0) {
+			ex_show("write failed: cannot create file");
+			free(r);
+			return 1;
+		}
+		write(fd, r, strlen(r));
+		close(fd);
+	} else {
+		for (s = r; (e = strchr(s, '\n')); s = e + 1) {
+			*e = '\0';
+			ex_print(s);
+		}
+	}
+	free(r);
+	return 0;
+}
+
 static int ec_setbufsmax(char *loc, char *cmd, char *arg)
 {
 	xbufsmax = *arg ? atoi(arg) : xbufsalloc;
@@ -995,6 +1489,7 @@ static int ec_setbufsmax(char *loc, char *cmd, char *arg)
 		ex_buf = bufidx >= &bufs[xbufsmax] - bufs ? bufs : bufs+bufidx;
 	ex_pbuf = pbufidx >= &bufs[xbufsmax] - bufs ? bufs : bufs+pbufidx;
 	ex_tpbuf = tpbufidx >= &bufs[xbufsmax] - bufs ? bufs : bufs+tpbufidx;
+	bufs_reindex();
 	return 0;
 }
 
@@ -1046,6 +1541,7 @@ static struct excmd {
 	{"inc", ec_setincl},
 	{"bx", ec_setbufsmax},
 	{"ac", ec_setacreg},
+	{"pf", ec_perf},
 	{"", ec_null},
 };
 
@@ -1094,6 +1590,48 @@ static const char *ex_parse(const char *src, char *loc, char *cmd, char *arg)
 	return *src == '|' ? src+1 : src;
 }
 
+/* parse the commands in ln and expand their arguments */
+static struct explan *ex_plan(const char *ln, int *n)
+{
+	int len = strlen(ln) + 1, sz = 4, idx;
+	char loc[len], cmd[len], arg[len];
+	struct explan *p = emalloc(sz * sizeof(p[0]));
+	for (*n = 0; *ln; (*n)++) {
+		if (*n == sz)
+			p = erealloc(p, (sz *= 2) * sizeof(p[0]));
+		ln = ex_parse(ln, loc, cmd, arg);
+		p[*n].loc = uc_dup(loc);
+		p[*n].cmd = uc_dup(cmd);
+		p[*n].arg = ex_pathexpand(arg);
+		idx = ex_idx(cmd);
+		p[*n].ec = idx >= 0 && p[*n].arg ? excmds[idx].ec : NULL;
+	}
+	return p;
+}
+
+/* run the commands of a plan; commands may modify their arguments */
+static int ex_planexec(struct explan *p, int n)
+{
+	int ret = 0;
+	for (int i = 0; i < n; i++) {
+		if (!p[i].ec)
+			continue;
+		char loc[strlen(p[i].loc) + 1], arg[strlen(p[i].arg) + 1];
+		ret = p[i].ec(strcpy(loc, p[i].loc), p[i].cmd, strcpy(arg, p[i].arg));
+	}
+	return ret;
+}
+
+static void ex_planfree(struct explan *p, int n)
+{
+	for (int i = 0; i < n; i++) {
+		free(p[i].loc);
+		free(p[i].cmd);
+		free(p[i].arg);
+	}
+	free(p);
+}
+
 /* execute a single ex command */
 int ex_exec(const char *ln)
 {
@@ -1,5 +1,6 @@
 #define NMARKS_BASE		('z' - 'a' + 2)
 #define NMARKS			32
+#define NGLOB			8	/* nesting depth of ex global commands */
 
 /* line operations */
 struct lopt {
@@ -11,10 +12,24 @@ struct lopt {
 	int *mark, *mark_off;	/* saved marks */
 };
 
+/* bracket summary of a line for each pair in "()[]{}" */
+struct lpair {
+	int net[3];		/* opening minus closing brackets */
+	int fmin[3];		/* lowest depth scanning forward (<= 0) */
+	int bmin[3];		/* lowest depth scanning backward (<= 0) */
+	int ok;			/* the summary is up to date */
+};
+
+/* ex global command marks of one depth; sorted runs of lines */
+struct lglob {
+	int *r;			/* the i-th run is lines [r[2 * i], r[2 * i + 1]) */
+	int n, sz;		/* number of runs and the allocated runs in r[] */
+};
+
 /* line buffers */
 struct lbuf {
 	char **ln;		/* buffer lines */
-	char *ln_glob;		/* line global mark */
+	struct lpair *ln_pair;	/* bracket summaries; allocated by lbuf_pair() */
 	struct lopt *hist;	/* buffer history */
 	int mark[NMARKS];	/* mark lines */
 	int mark_off[NMARKS];	/* mark line offsets */
@@ -26,8 +41,12 @@ struct lbuf {
 	int hist_u;		/* current undo head in hist[] */
 	int useq_zero;		/* useq for lbuf_saved() */
 	int useq_last;		/* useq before hist[] */
+	struct lglob glob[NGLOB];	/* ex global command marks */
+	int stamp;		/* changed by every line replacement */
 };
 
+static int lbuf_stamps;		/* the last stamp given to a buffer */
+
 struct lbuf *lbuf_make(void)
 {
 	struct lbuf *lb = emalloc(sizeof(*lb));
@@ -36,6 +55,7 @@ struct lbuf *lbuf_make(void)
 	for (i = 0; i < LEN(lb->mark); i++)
 		lb->mark[i] = -1;
 	lb->useq = 1;
+	lb->stamp = ++lbuf_stamps;
 	return lb;
 }
 
@@ -91,7 +111,9 @@ void lbuf_free(struct lbuf *lb)
 		lopt_done(&lb->hist[i]);
 	free(lb->hist);
 	free(lb->ln);
-	free(lb->ln_glob);
+	for (i = 0; i < NGLOB; i++)
+		free(lb->glob[i].r);
+	free(lb->ln_pair);
 	free(lb);
 }
 
@@ -111,21 +133,62 @@ static int lbuf_linecount(char *s)
 	return n;
 }
 
+static void lglob_room(struct lglob *g, int n)
+{
+	if (g->n + n > g->sz) {
+		g->sz = MAX(g->sz * 2, g->n + n);
+		g->r = erealloc(g->r, g->sz * 2 * sizeof(g->r[0]));
+	}
+}
+
+/* update global command marks after replacing n_del lines at pos with n_ins */
+static void lglob_shift(struct lglob *g, int pos, int n_del, int n_ins)
+{
+	int p = pos + MIN(n_del, n_ins);	/* the first n_del lines keep their marks */
+	int i, j, d = n_ins - n_del;
+	if (d > 0) {	/* insert d unmarked lines at p */
+		lglob_room(g, 1);
+		for (i = g->n - 1; i >= 0 && g->r[2 * i + 1] > p; i--) {
+			if (g->r[2 * i] < p) {	/* split the run */
+				memmove(g->r + 2 * i + 2, g->r + 2 * i, (g->n - i) * 2 * sizeof(g->r[0]));
+				g->r[2 * i + 1] = p;
+				g->r[2 * i + 2] = p + d;
+				g->r[2 * i + 3] += d;
+				g->n++;
+				break;
+			}
+			g->r[2 * i] += d;
+			g->r[2 * i + 1] += d;
+		}
+		return;
+	}
+	for (i = 0, j = 0; i < g->n; i++) {	/* remove lines [p, p - d) */
+		int beg = g->r[2 * i], end = g->r[2 * i + 1];
+		beg = beg < p ? beg : MAX(p, beg + d);
+		end = end < p ? end : MAX(p, end + d);
+		if (beg < end) {
+			g->r[2 * j] = beg;
+			g->r[2 * j + 1] = end;
+			j++;
+		}
+	}
+	g->n = j;
+}
+
 /* low-level line replacement */
 static void lbuf_replace(struct lbuf *lb, char *s, struct lopt *lo, int n_del, int n_ins)
 {
 	int i, pos = lo->pos;
 	rstate->ren_laststr = NULL; /* there is no guarantee malloc not giving same ptr back */
+	lb->stamp = ++lbuf_stamps;
 	while (lb->ln_n + n_ins - n_del >= lb->ln_sz) {
 		int nsz = lb->ln_sz + (lb->ln_sz ? lb->ln_sz : 512);
 		char **nln = emalloc(nsz * sizeof(nln[0]));
-		char *nln_glob = emalloc(nsz * sizeof(nln_glob[0]));
 		memcpy(nln, lb->ln, lb->ln_n * sizeof(lb->ln[0]));
-		memcpy(nln_glob, lb->ln_glob, lb->ln_n * sizeof(lb->ln_glob[0]));
 		free(lb->ln);
-		free(lb->ln_glob);
 		lb->ln = nln;
-		lb->ln_glob = nln_glob;
+		if (lb->ln_pair)
+			lb->ln_pair = erealloc(lb->ln_pair, nsz * sizeof(lb->ln_pair[0]));
 		lb->ln_sz = nsz;
 	}
 	for (i = 0; i < n_del; i++)
@@ -133,8 +196,9 @@ static void lbuf_replace(struct lbuf *lb, char *s, struct lopt *lo, int n_del, i
 	if (n_ins != n_del) {
 		memmove(lb->ln + pos + n_ins, lb->ln + pos + n_del,
 			(lb->ln_n - pos - n_del) * sizeof(lb->ln[0]));
-		memmove(lb->ln_glob + pos + n_ins, lb->ln_glob + pos + n_del,
-			(lb->ln_n - pos - n_del) * sizeof(lb->ln_glob[0]));
+		if (lb->ln_pair)
+			memmove(lb->ln_pair + pos + n_ins, lb->ln_pair + pos + n_del,
+				(lb->ln_n - pos - n_del) * sizeof(lb->ln_pair[0]));
 	}
 	lb->ln_n += n_ins - n_del;
 	for (i = 0; i < n_ins; i++) {
@@ -149,8 +213,11 @@ static void lbuf_replace(struct lbuf *lb, char *s, struct lopt *lo, int n_del, i
 		lb->ln[pos + i] = n;
 		s += l;
 	}
-	for (i = n_del; i < n_ins; i++)
-		lb->ln_glob[pos + i] = 0;
+	for (i = 0; i < NGLOB; i++)
+		if (lb->glob[i].n && n_ins != n_del)
+			lglob_shift(&lb->glob[i], pos, n_del, n_ins);
+	for (i = 0; lb->ln_pair && i < n_ins; i++)
+		lb->ln_pair[pos + i].ok = 0;
 	for (i = 0; i < NMARKS_BASE; i++) {	/* updating marks */
 		if (!s && lb->mark[i] >= pos && lb->mark[i] < pos + n_del) {
 			lbuf_savemark(lb, lo, i, i);
@@ -284,6 +351,12 @@ int lbuf_len(struct lbuf *lb)
 	return lb->ln_n;
 }
 
+/* a number that differs for every state of the lines of any buffer */
+int lbuf_stamp(struct lbuf *lb)
+{
+	return lb->stamp;
+}
+
 void lbuf_mark(struct lbuf *lbuf, int mark, int pos, int off)
 {
 	if (markidx(mark) >= 0) {
@@ -303,6 +376,15 @@ int lbuf_jump(struct lbuf *lbuf, int mark, int *pos, int *off)
 	return 0;
 }
 
+/* return nonzero if a mark is on a line in [beg, end) */
+int lbuf_marked(struct lbuf *lb, int beg, int end)
+{
+	for (int i = 0; i < NMARKS_BASE; i++)
+		if (lb->mark[i] >= beg && lb->mark[i] < end)
+			return 1;
+	return 0;
+}
+
 int lbuf_undo(struct lbuf *lb)
 {
 	if (!lb->hist_u)
@@ -364,18 +446,56 @@ int lbuf_modified(struct lbuf *lb)
 	return lbuf_seq(lb) != lb->useq_zero;
 }
 
-/* mark the line for ex global command */
-void lbuf_globset(struct lbuf *lb, int pos, int dep)
+/* mark lines [beg, end), and only them, for ex global command of depth dep */
+void lbuf_globset(struct lbuf *lb, int beg, int end, int dep)
 {
-	lb->ln_glob[pos] |= 1 << dep;
+	struct lglob *g;
+	if (dep < 0 || dep >= NGLOB)
+		return;
+	g = &lb->glob[dep];
+	g->n = 0;
+	if (beg < end) {
+		lglob_room(g, 1);
+		g->r[0] = beg;
+		g->r[1] = end;
+		g->n = 1;
+	}
+}
+
+/* return and clear the first marked line at or after pos; -1 if none */
+int lbuf_globnext(struct lbuf *lb, int pos, int dep)
+{
+	struct lglob *g;
+	int i;
+	if (dep < 0 || dep >= NGLOB)
+		return -1;
+	g = &lb->glob[dep];
+	for (i = 0; i < g->n && g->r[2 * i + 1] <= pos; i++)
+		;
+	if (i == g->n)
+		return -1;
+	if (g->r[2 * i] >= pos) {
+		pos = g->r[2 * i]++;
+	} else {	/* split the run */
+		lglob_room(g, 1);
+		memmove(g->r + 2 * i + 2, g->r + 2 * i, (g->n - i) * 2 * sizeof(g->r[0]));
+		g->r[2 * i + 1] = pos;
+		g->r[2 * i + 2] = pos + 1;
+		g->n++;
+		i++;
+	}
+	if (g->r[2 * i] == g->r[2 * i + 1]) {
+		memmove(g->r + 2 * i, g->r + 2 * i + 2, (g->n - i - 1) * 2 * sizeof(g->r[0]));
+		g->n--;
+	}
+	return pos;
 }
 
-/* return and clear ex global command mark */
-int lbuf_globget(struct lbuf *lb, int pos, int dep)
+/* clear the marks of ex global command of depth dep */
+void lbuf_globclear(struct lbuf *lb, int dep)
 {
-	int o = lb->ln_glob[pos] & (1 << dep);
-	lb->ln_glob[pos] &= ~(1 << dep);
-	return o > 0;
+	if (dep >= 0 && dep < NGLOB)
+		lb->glob[dep].n = 0;
 }
 
 int lbuf_indents(struct lbuf *lb, int r)
@@ -569,30 +689,76 @@ int lbuf_wordend(struct lbuf *lb, int big, int dir, int *row, int *off)
 	return 0;
 }
 
+static char pairs[] = "()[]{}";
+
+/* summarize the brackets of line r */
+static struct lpair *lbuf_pairsum(struct lbuf *lb, int r)
+{
+	struct lpair *lp = &lb->ln_pair[r];
+	int dep[3] = {0}, pmin[3] = {0}, t;
+	char *s, *q;
+	if (lp->ok)
+		return lp;
+	memset(lp, 0, sizeof(*lp));
+	for (s = lb->ln[r]; *s; s++) {
+		if (!(q = strchr(pairs, *s)))
+			continue;
+		t = (q - pairs) / 2;
+		pmin[t] = MIN(pmin[t], dep[t]);
+		dep[t] += (q - pairs) & 1 ? -1 : 1;
+		lp->fmin[t] = MIN(lp->fmin[t], dep[t]);
+	}
+	for (t = 0; t < 3; t++) {
+		lp->net[t] = dep[t];
+		lp->bmin[t] = MIN(pmin[t], dep[t]) - dep[t];
+	}
+	lp->ok = 1;
+	return lp;
+}
+
+/* scan ln from byte i for the bracket closing pairs[p] at depth dep */
+static int lbuf_pairscan(char *ln, int i, int p, int *dep)
+{
+	int dir = (p & 1) ? -1 : +1;
+	for (; i >= 0 && ln[i]; i += dir) {
+		if (ln[i] == pairs[p ^ 1] && !--*dep)
+			return i;
+		if (ln[i] == pairs[p])
+			++*dep;
+	}
+	return -1;
+}
+
 /* move to the matching character */
 int lbuf_pair(struct lbuf *lb, int *row, int *off)
 {
-	int r = *row, o = *off;
-	char *pairs = "()[]{}";
-	int c;			/* parenthesis character */
-	int p;			/* index for pairs[] */
+	char *ln = lbuf_get(lb, *row);
+	char *s = uc_chr(ln, *off);
+	int r = *row, i, p, t, dir;
 	int dep = 1;		/* parenthesis depth */
-	while ((c = (unsigned char) lbuf_chr(lb, r, o)[0]) && !strchr(pairs, c))
-		o++;
-	if (!c)
+	struct lpair *lp;
+	s += strcspn(s, pairs);
+	if (!*s)
 		return 1;
-	p = strchr(pairs, c) - pairs;
-	while (!lbuf_next(lb, (p & 1) ? -1 : +1, &r, &o)) {
-		int c = (unsigned char) lbuf_chr(lb, r, o)[0];
-		if (c == pairs[p ^ 1])
-			dep--;
-		if (c == pairs[p])
-			dep++;
-		if (!dep) {
-			*row = r;
-			*off = o;
-			return 0;
-		}
+	p = strchr(pairs, *s) - pairs;
+	t = p / 2;
+	dir = (p & 1) ? -1 : +1;
+	if (!lb->ln_pair) {
+		lb->ln_pair = emalloc(lb->ln_sz * sizeof(lb->ln_pair[0]));
+		for (i = 0; i < lb->ln_sz; i++)
+			lb->ln_pair[i].ok = 0;
+	}
+	/* skip the lines in which the depth cannot drop to zero */
+	for (i = lbuf_pairscan(ln, s - ln + dir, p, &dep); i < 0;) {
+		if (!(ln = lbuf_get(lb, r += dir)))
+			return 1;
+		lp = lbuf_pairsum(lb, r);
+		if (dep + (dir > 0 ? lp->fmin[t] : lp->bmin[t]) > 0)
+			dep += dir * lp->net[t];
+		else
+			i = lbuf_pairscan(ln, dir > 0 ? 0 : lbuf_slen(ln), p, &dep);
 	}
-	return 1;
+	*row = r;
+	*off = uc_off(ln, i);
+	return 0;
 }
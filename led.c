@@ -1,7 +1,11 @@
 /* line editing and drawing */
 
 static sbuf *suggestsb;
-static sbuf *acsb;
+static sbuf *acsb;		/* autocomplete db: "\n", then words ending in "\n" */
+static int *ac_tab;		/* offsets of acsb words hashed by word */
+static int ac_tabsz, ac_n;
+static unsigned long long *ac_lns;	/* hashes of the lines already indexed */
+static int ac_lnsz, ac_lnn;
 
 int dstrlen(const char *s, char delim)
 {
@@ -38,22 +42,92 @@ static int search(const char *pattern, int l)
 	return suggestsb->s_n;
 }
 
+static unsigned long long ac_hash(unsigned long long h, const char *s, int n)
+{
+	while (n-- > 0)
+		h = (h ^ (unsigned char) *s++) * 1099511628211ULL;
+	return h;
+}
+
+/* add line hash h to ac_lns; return nonzero if it was there */
+static int ac_lnseen(unsigned long long h)
+{
+	unsigned long long *old = ac_lns;
+	int i, j, n = ac_lnsz;
+	h += !h;
+	if ((ac_lnn + 1) * 2 > ac_lnsz) {
+		ac_lnsz = ac_lnsz ? ac_lnsz * 2 : 1024;
+		ac_lns = emalloc(ac_lnsz * sizeof(ac_lns[0]));
+		memset(ac_lns, 0, ac_lnsz * sizeof(ac_lns[0]));
+		for (j = 0; j < n; j++) {
+			if (!old[j])
+				continue;
+			for (i = old[j] & (ac_lnsz - 1); ac_lns[i];)
+				i = (i + 1) & (ac_lnsz - 1);
+			ac_lns[i] = old[j];
+		}
+		free(old);
+	}
+	for (i = h & (ac_lnsz - 1); ac_lns[i]; i = (i + 1) & (ac_lnsz - 1))
+		if (ac_lns[i] == h)
+			return 1;
+	ac_lns[i] = h;
+	ac_lnn++;
+	return 0;
+}
+
+static int *ac_slot(char *s, int len)
+{
+	int m = ac_tabsz - 1, i = bufs_hash(s, len) & m, off;
+	for (; (off = ac_tab[i]); i = (i + 1) & m)
+		if (off + len < acsb->s_n && acsb->s[off + len] == '\n' &&
+				!memcmp(acsb->s + off, s, len))
+			break;
+	return &ac_tab[i];
+}
+
+/* append word s to acsb unless it is there */
+static void ac_add(char *s, int len)
+{
+	int *old = ac_tab, *slot;
+	int i, n = ac_tabsz;
+	if ((ac_n + 1) * 2 > ac_tabsz) {
+		ac_tabsz = ac_tabsz ? ac_tabsz * 2 : 1024;
+		ac_tab = emalloc(ac_tabsz * sizeof(ac_tab[0]));
+		memset(ac_tab, 0, ac_tabsz * sizeof(ac_tab[0]));
+		for (i = 0; i < n; i++)
+			if (old[i])
+				*ac_slot(acsb->s + old[i], dstrlen(acsb->s + old[i], '\n')) = old[i];
+		free(old);
+	}
+	if (*(slot = ac_slot(s, len)))
+		return;
+	*slot = acsb->s_n;
+	ac_n++;
+	sbuf_mem(acsb, s, len)
+	sbuf_chr(acsb, '\n')
+}
+
+/* add the words of buf to acsb; lines indexed before with the same
+ * regex are skipped, their words are already there */
 static void file_index(struct lbuf *buf)
 {
 	char reg[] = "[^\t ;:,`.<>[\\]\\^%$#@*\\!?+\\-|/\\=\\\\{}&\\()'\"]+";
+	char *re = xacreg ? xacreg->s : reg;
 	int len, sidx, grp = xgrp;
 	char **ss = lbuf_buf(buf);
 	int ln_n = lbuf_len(buf);
-	int subs[grp], n;
-	sbuf *ibuf;
-	rset *rs = rset_make(1, (char*[]){xacreg ? xacreg->s : reg}, xic ? REG_ICASE : 0);
+	int subs[grp], ic = xic;
+	unsigned long long seed = 14695981039346656037ULL;
+	rset *rs = rset_make(1, (char*[]){re}, ic ? REG_ICASE : 0);
 	if (!rs)
 		return;
-	sbuf_make(ibuf, 1024)
-	for (n = 1; n <= acsb->s_n; n++)
-		if (acsb->s[n - 1] == '\n')
-			sbuf_mem(ibuf, &n, (int)sizeof(n))
+	seed = ac_hash(seed, re, strlen(re) + 1);
+	seed = ac_hash(seed, (char*)&grp, (int)sizeof(grp));
+	seed = ac_hash(seed, (char*)&ic, (int)sizeof(ic));
 	for (int i = 0; i < ln_n; i++) {
+		if (ac_lnseen(ac_hash(seed, ss[i], lbuf_slen(ss[i]))))
+			continue;
 		sidx = 0;
 		while (rset_find(rs, ss[i]+sidx, grp / 2, subs,
 				sidx ? REG_NOTBOL | REG_NEWLINE : REG_NEWLINE) >= 0) {
@@ -64,23 +138,12 @@ static void file_index(struct lbuf *buf)
 				continue;
 			}
 			len = subs[grp - 1] - subs[grp - 2];
-			if (len > 1) {
-				char *part = ss[i]+sidx+subs[grp - 2];
-				int *ip = (int*)(ibuf->s+sizeof(n));
-				for (n = len+1; ip < (int*)&ibuf->s[ibuf->s_n]; ip++)
-					if (*ip - ip[-1] == n &&
-						!memcmp(acsb->s + ip[-1], part, len))
-							goto skip;
-				sbuf_mem(acsb, part, len)
-				sbuf_chr(acsb, '\n')
-				sbuf_mem(ibuf, &acsb->s_n, (int)sizeof(n))
-			}
-			skip:
+			if (len > 1)
+				ac_add(ss[i]+sidx+subs[grp - 2], len);
 			sidx += subs[grp - 1] > 0 ? subs[grp - 1] : 1;
 		}
 	}
 	sbuf_null(acsb)
-	sbuf_free(ibuf)
 	rset_free(rs);
 }
 
@@ -163,14 +226,13 @@ else if (*chrs[o] == '\t') \
 #define led_out(out, n) \
 { int l, att_old = 0, i = 0; \
 while (i < cterm) { \
-	int att_new = 0; \
 	o = off[i]; \
 	if (o >= 0) { \
 		for (l = i; off[i] == o; i++); \
-		att_new = ratt[o]; \
-		if (att_new != att_old) \
-			sbuf_str(out, term_att(att_new)) \
-		char *s = ren_translate(chrs[o], s0); \
+		if (ratt[o] != att_old) \
+			sbuf_str(out, term_att(ratt[o], att_old)) \
+		att_old = ratt[o]; \
+		char *s = ren_translate(chrs, o); \
 		if (s) \
 			sbuf_str(out, s) \
 		else if (uc_isprint(chrs[o])) { \
@@ -181,20 +243,110 @@ while (i < cterm) { \
 		} \
 	} else { \
 		if (cbeg || ctx < 0) { \
-			if (att_new != att_old) \
-				sbuf_str(out, term_att(0)) \
+			if (att_old) \
+				sbuf_str(out, term_att(0, att_old)) \
+			att_old = 0; \
 			sbuf_chr(out, ' ') \
 		} \
 		i++; \
 	} \
-	att_old = att_new; \
-} sbufn_str(out, term_att(0)) } \
+} sbufn_str(out, term_att(0, att_old)) } \
+
+/* attribute overlays merged into the rendered buffer rows */
+static struct ovl {
+	int id;			/* the owner */
+	int row;		/* the buffer row; -1 for the occurrences of w */
+	char *w;		/* the marked word */
+	int beg, end;		/* the marked characters of row; for w beg means whole words */
+	int att;
+} ovls[8];
+static int ovls_n;
+int led_ovlrow = -1;		/* the buffer row led_render() draws, -2 for words only */
+
+/* mark characters [beg, end) of buffer row, the whole row below syntax
+ * highlighting if end < 0; row < 0 removes the marks of id (all if 0) */
+void led_overlay(int id, int row, int beg, int end, int att)
+{
+	int i, j;
+	if (row < 0) {
+		for (i = 0, j = 0; i < ovls_n; i++) {
+			if (id && ovls[i].id != id)
+				ovls[j++] = ovls[i];
+			else
+				free(ovls[i].w);
+		}
+		ovls_n = j;
+	} else if (ovls_n < LEN(ovls)) {
+		ovls[ovls_n].id = id;
+		ovls[ovls_n].row = row;
+		ovls[ovls_n].w = NULL;
+		ovls[ovls_n].beg = beg;
+		ovls[ovls_n].end = end;
+		ovls[ovls_n++].att = att;
+	}
+}
+
+/* mark every occurrence of w in the rendered buffer rows */
+void led_overlayw(int id, char *w, int whole, int att)
+{
+	if (*w && ovls_n < LEN(ovls)) {
+		ovls[ovls_n].id = id;
+		ovls[ovls_n].row = -1;
+		ovls[ovls_n].w = uc_dup(w);
+		ovls[ovls_n].beg = whole;
+		ovls[ovls_n++].att = att;
+	}
+}
+
+/* the number of overlays of id */
+int led_overlays(int id)
+{
+	int i, n = 0;
+	for (i = 0; i < ovls_n; i++)
+		n += ovls[i].id == id;
+	return n;
+}
+
+/* apply the overlays of led_ovlrow to the attributes of the first n
+ * characters of its line s */
+static void led_markovl(char *s, int *att, int n)
+{
+	int i, j, end, c, l;
+	char *p, *q;
+	for (i = 0; i < ovls_n; i++) {
+		struct ovl *o = &ovls[i];
+		if (o->w) {
+			l = strlen(o->w);
+			for (p = s, c = 0; (q = strstr(p, o->w));) {
+				c += uc_off(p, q - p);
+				if (o->beg && ((q > s && uc_kind(uc_beg(s, q - 1)) == 1) ||
+						uc_kind(q + l) == 1)) {
+					p = uc_next(q);
+					c++;
+					continue;
+				}
+				end = c + uc_off(q, l);
+				for (; c < end; c++)
+					if (c < n)
+						att[c] = syn_merge(att[c], o->att);
+				p = q + l;
+			}
+		} else if (o->row == led_ovlrow && o->end < 0) {
+			for (j = 0; j < n; j++)
+				att[j] = syn_merge(o->att, att[j]);
+		} else if (o->row == led_ovlrow) {
+			for (j = o->beg; j < o->end && j < n; j++)
+				att[j] = syn_merge(att[j], o->att);
+		}
+	}
+}
 
 /* render and highlight a line */
 void led_render(char *s0, int row, int cbeg, int cend)
 {
 	if (!xled)
 		return;
+	long tm = term_clock();
 	int j, n, i = 0, o = 0, cterm = cend - cbeg;
 	char *bound = s0;
 	int *pos;		/* pos[i]: the screen position of the i-th character */
@@ -255,6 +407,8 @@ void led_render(char *s0, int row, int cbeg, int cend)
 				i++;
 		}
 	}
+	if (xhl && ovls_n && led_ovlrow != -1)
+		led_markovl(s0, ratt, ratt == att ? MIN(n, cterm) : n);
 	if (xhlr)
 		led_markrev(n, chrs, pos, ratt);
 	/* generate term output */
@@ -264,8 +418,7 @@ void led_render(char *s0, int row, int cbeg, int cend)
 		led_out(term_sbuf, 2)
 	else
 		led_out(term_sbuf, 1)
-	if (!term_record)
-		term_commit();
+	term_time(PF_REN, tm);
 }
 
 static int led_lastchar(char *s)
@@ -288,7 +441,7 @@ static int led_lastword(char *s)
 	return r - s;
 }
 
-static void led_printparts(char *ai, char *pref, char *main, char *post)
+static void led_printparts(char *ai, char *pref, char *main, char *post, int ovl)
 {
 	if (!xled)
 		return;
@@ -310,7 +463,9 @@ static void led_printparts(char *ai, char *pref, char *main, char *post)
 	if (pos < xleft)
 		xleft = pos < xcols ? 0 : pos - xcols / 2;
 	syn_blockhl = 0;
+	led_ovlrow = ovl;
 	led_print(ln->s, -1);
+	led_ovlrow = -1;
 	/* cursor position for inserting the next character */
 	if (*pref || *main || *ai) {
 		if (off - 2 >= 0)
@@ -365,9 +520,11 @@ char *led_read(int *kmap, int c)
 static void led_info(char *str, int ai_max)
 {
 	rstate->ren_laststr = NULL;
+	term_frame();
 	led_render(str, xtop+xrows, 0, xcols);
 	if (ai_max >= 0)
 		term_pos(xrow - xtop, 0);
+	term_commit();
 }
 
 /* read a line from the terminal */
@@ -376,7 +533,7 @@ static char *led_line(char *pref, char *post, char *ai,
 		char *insert, int orow)
 {
 	sbuf *sb;
-	int ai_len = strlen(ai), len, p_reg = 0;
+	int ai_len = strlen(ai), len, p_reg = 0, p_len;
 	int c, lnmode, i = 0, last_sug = 0, sug_pt = -1;
 	char *cs, *sug = NULL, *_sug = NULL;
 	sbufn_make(sb, xcols)
@@ -387,9 +544,21 @@ static char *led_line(char *pref, char *post, char *ai,
 	if (!post)
 		post = "";
 	while (1) {
-		led_printparts(ai, pref, sb->s, post);
+		term_frame();
+		led_printparts(ai, pref, sb->s, post, ai_max >= 0 ? -2 : -1);
+		term_commit();
 		len = sb->s_n;
 		c = term_read();
+		/* insert pasted text as is */
+		if (ai_max >= 0 && (cs = term_paste(&p_len))) {
+			sbuf_chr(sb, c)
+			sbufn_mem(sb, cs, p_len)
+			if (c == '\n' || memchr(cs, '\n', p_len)) {
+				c = 0;	/* led_input() commits the pasted lines */
+				goto leave;
+			}
+			continue;
+		}
 		switch (c) {
 		case TK_CTL('h'):
 		case 127:
@@ -456,6 +625,9 @@ static char *led_line(char *pref, char *post, char *ai,
 				sbufn_chr(acsb, '\n')
 			}
 			file_index(xb);
+			for (int b = 0; b < xbufcur; b++)
+				if (bufs[b].lb != xb)
+					file_index(bufs[b].lb);
 			break;
 		case TK_CTL('y'):
 			led_done();
@@ -516,6 +688,7 @@ static char *led_line(char *pref, char *post, char *ai,
 			if (ai_max >= 0) {
 				pac:;
 				int r = xrow-xtop+1;
+				term_frame();
 				if (sug)
 					goto pac_;
 				c = sug_pt >= 0 ? sug_pt : led_lastword(sb->s);
@@ -536,9 +709,12 @@ static char *led_line(char *pref, char *post, char *ai,
 				}
 				for (; r < xrows; r++) {
 					cs = lbuf_get(xb, (r-(xrow-orow))+xtop);
+					led_ovlrow = cs ? (r-(xrow-orow))+xtop : -1;
 					led_print(cs ? cs : "~", r);
+					led_ovlrow = -1;
 				}
 				term_pos(xrow - xtop, 0);
+				term_commit();
 				continue;
 			}
 			temp_pos(0, -1, 0, 0);
@@ -616,21 +792,63 @@ char *led_prompt(char *pref, char *post, char *insert,
 	return NULL;
 }
 
-/* read visual command input */
-sbuf *led_input(char *pref, char **post, int *kmap, int row)
+/* draw the lines of ln before its last newline as finished lines */
+static void led_pasted(char *ai, char *pref, char *ln, char *nl)
+{
+	int n = 0, i;
+	char *s, *e;
+	for (s = ln; s <= nl; s++)
+		n += *s == '\n';
+	term_frame();
+	for (i = 0, s = ln; s <= nl; s = e + 1, i++) {
+		e = strchr(s, '\n');
+		if (n - i <= xrows) {	/* the rest scroll out of the screen */
+			*e = '\0';
+			led_printparts(i ? "" : ai, i ? "" : pref, s, "", -2);
+			*e = '\n';
+			term_chr('\n');
+			term_room(1);
+		}
+		xrow++;
+	}
+	term_commit();
+}
+
+/* read visual command input replacing nrow lines at *row; pasted lines are
+ * committed to xb before *row as they arrive and *row is moved after them */
+sbuf *led_input(char *pref, char **post, int *kmap, int *row, int nrow)
 {
 	sbuf *sb; sbuf_make(sb, 256)
 	int ai_max = 128 * xai;
 	char ai[ai_max+1];
-	int n = 0, key, orow = row;
+	int n = 0, key, orow = *row + nrow - 1;
+	char *ins = NULL, *nl;
 	while (n < ai_max && (*pref == ' ' || *pref == '\t'))
 		ai[n++] = *pref++;
 	ai[n] = '\0';
 	while (1) {
-		char *ln = led_line(pref, *post, ai, ai_max, &key, kmap, NULL, orow);
+		char *ln = led_line(pref, *post, ai, ai_max, &key, kmap, ins, orow);
+		free(ins);
+		ins = NULL;
 		sbuf_str(sb, ai)
 		if (pref[0])
 			sbuf_str(sb, pref)
+		if (!key && (nl = strrchr(ln, '\n'))) {	/* pasted lines */
+			sbufn_mem(sb, ln, nl - ln + 1)
+			led_pasted(ai, pref, ln, nl);
+			ins = uc_dup(nl + 1);
+			lbuf_edit(xb, sb->s, *row, *row);
+			for (n = 0; n < sb->s_n; n++)
+				if (sb->s[n] == '\n') {
+					++*row;
+					orow++;
+				}
+			sbuf_cut(sb, 0)
+			ai[0] = '\0';
+			pref[0] = '\0';
+			free(ln);
+			continue;
+		}
 		sbuf_str(sb, ln)
 		if (key == '\n')
 			sbuf_chr(sb, '\n')
@@ -638,7 +856,8 @@ sbuf *led_input(char *pref, char **post, int *kmap, int row)
 			free(ln);
 			break;
 		}
-		led_printparts(ai, pref, uc_lastline(ln), "");
+		term_frame();
+		led_printparts(ai, pref, uc_lastline(ln), "", -2);
 		term_chr('\n');
 		if (ai_max && !pref[0]) {	/* updating autoindent */
 			int ai_new = 0; 	/* number of initial spaces in ln */
@@ -652,6 +871,7 @@ sbuf *led_input(char *pref, char **post, int *kmap, int row)
 		}
 		free(ln);
 		term_room(1);
+		term_commit();
 		pref[0] = '\0';
 		if (ai_max)
 			while (**post == ' ' || **post == '\t')
@@ -667,5 +887,10 @@ void led_done(void)
 	if (suggestsb) {
 		sbuf_free(suggestsb)
 		sbuf_free(acsb)
+		free(ac_tab);
+		free(ac_lns);
+		ac_tab = NULL;
+		ac_lns = NULL;
+		ac_tabsz = ac_n = ac_lnsz = ac_lnn = 0;
 	}
 }
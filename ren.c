@@ -16,19 +16,58 @@ static void dir_reverse(int *ord, int beg, int end)
 	}
 }
 
+/* per-line cache of direction contexts and reorderings, keyed by content */
+#define DIR_NCACHE	64
+static struct dir_line {
+	char *s;	/* a copy of the line */
+	int len;	/* length of s */
+	int ctx;	/* the matching dctxs[] index; -1 if none, -2 if unknown */
+	int rdir;	/* the context ord was computed for; 0 if unknown */
+	int *ord;	/* the reordering; NULL if identity */
+} dir_lines[DIR_NCACHE];
+
+static struct dir_line *dir_line(char *s)
+{
+	int len = strlen(s);
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < len; i++)
+		h = (h ^ (unsigned char) s[i]) * 16777619u;
+	struct dir_line *dl = &dir_lines[h % DIR_NCACHE];
+	if (dl->s && dl->len == len && !memcmp(dl->s, s, len))
+		return dl;
+	free(dl->s);
+	free(dl->ord);
+	dl->s = emalloc(len + 1);
+	memcpy(dl->s, s, len + 1);
+	dl->len = len;
+	dl->ctx = -2;
+	dl->rdir = 0;
+	dl->ord = NULL;
+	return dl;
+}
+
 /* reorder the characters based on direction marks and characters */
 static int dir_reorder(char **chrs, int *ord, int end)
 {
 	int dir = dir_context(chrs[0]);
+	struct dir_line *dl = dir_line(chrs[0]);
 	rset *rs = dir < 0 ? dir_rsrl : dir_rslr;
 	int beg = 0, end1 = end, r_beg, r_end, c_beg, c_end;
-	int subs[32], grp, found;
+	int subs[32], grp, found, i;
+	if (dl->rdir == dir) {
+		if (dl->ord)
+			memcpy(ord, dl->ord, end * sizeof(ord[0]));
+		return dl->ord != NULL;
+	}
+	free(dl->ord);
+	dl->ord = NULL;
+	dl->rdir = dir;
 	while (beg < end) {
 		char *s = chrs[beg];
 		found = rset_find(rs, s, 16, subs,
 				*chrs[end-1] == '\n' ? REG_NEWLINE : 0);
 		if (found >= 0) {
-			for (int i = 0; i < end1; i++)
+			for (i = 0; i < end1; i++)
 				ord[i] = i;
 			end1 = -1;
 			grp = dmarks[found].grp;
@@ -44,20 +83,31 @@ static int dir_reorder(char **chrs, int *ord, int end)
 		} else
 			break;
 	}
-	return end1 < 0;
+	if (end1 < 0) {
+		for (i = 0; i < end && ord[i] == i; i++);
+		if (i < end) {
+			dl->ord = emalloc(end * sizeof(ord[0]));
+			memcpy(dl->ord, ord, end * sizeof(ord[0]));
+		}
+	}
+	return dl->ord != NULL;
 }
 
 /* return the direction context of the given line */
 int dir_context(char *s)
 {
-	int found;
+	struct dir_line *dl;
 	if (xtd > +1)
 		return +1;
 	if (xtd < -1)
 		return -1;
-	if (dir_rsctx && s)
-		if ((found = rset_find(dir_rsctx, s, 0, NULL, 0)) >= 0)
-			return dctxs[found].dir;
+	if (dir_rsctx && s) {
+		dl = dir_line(s);
+		if (dl->ctx == -2)
+			dl->ctx = rset_find(dir_rsctx, s, 0, NULL, 0);
+		if (dl->ctx >= 0)
+			return dctxs[dl->ctx].dir;
+	}
 	return xtd < 0 ? -1 : +1;
 }
 
@@ -85,6 +135,17 @@ void ren_done(void)
 {
 	free(rstate->ren_lastpos);
 	free(rstate->ren_lastchrs);
+	free(rstate->ren_lastshp);
+	rstate->ren_lastshp = NULL;
+}
+
+/* every character of s is one column wide */
+static int ren_isascii(char *s, int len)
+{
+	for (int i = 0; i < placeholderslen; i++)
+		if (placeholders[i].cp < 0x80)
+			return 0;
+	return uc_ascii(s, len, 1) == len;
 }
 
 /* specify the screen position of the characters in s */
@@ -108,6 +169,10 @@ int *ren_position(char *s, char ***chrs, int *n)
 			pos[off[i]] = cpos;
 			cpos += ren_cwid(chrs[0][off[i]], cpos);
 		}
+	} else if (ren_isascii(s, chrs[0][nn] - s)) {
+		for (i = 0; i < nn; i++)
+			pos[i] = i;
+		cpos = nn;
 	} else {
 		for (i = 0; i < nn; i++) {
 			pos[i] = cpos;
@@ -212,8 +277,9 @@ int ren_cwid(char *s, int pos)
 	return uc_wid(c);
 }
 
-char *ren_translate(char *s, char *ln)
+char *ren_translate(char **chrs, int o)
 {
+	char *s = chrs[o];
 	int c; uc_code(c, s)
 	for (int i = 0; i < placeholderslen; i++)
 		if (placeholders[i].cp == c)
@@ -226,7 +292,15 @@ char *ren_translate(char *s, char *ln)
 	}
 	if (uc_isbell(c))
 		return "�";
-	return !xshape ? NULL : uc_shape(ln, s);
+	if (!xshape)
+		return NULL;
+	if (chrs != rstate->ren_lastchrs)
+		return uc_shape(chrs[0], s);
+	if (!rstate->ren_lastshp) {
+		rstate->ren_lastshp = emalloc(rstate->ren_lastn * sizeof(rstate->ren_lastshp[0]) + 1);
+		uc_shapeln(chrs, rstate->ren_lastn, rstate->ren_lastshp);
+	}
+	return rstate->ren_lastshp[o][0] ? rstate->ren_lastshp[o] : NULL;
 }
 
 #define NFTS		30
@@ -363,17 +437,25 @@ void syn_reloadft(void)
 	}
 }
 
-int syn_addhl(char *reg, int func, int reload)
+/* the index in hls[] of the current filetype's pattern used by func */
+int syn_findhl(int func)
 {
 	for (int i = ftmap[ftidx].setbidx; i < ftmap[ftidx].seteidx; i++)
-		if (hls[i].func == func) {
-			hls[i].pat = reg;
-			syn_reload = reload;
+		if (hls[i].func == func)
 			return i;
-		}
 	return -1;
 }
 
+int syn_addhl(char *reg, int func, int reload)
+{
+	int i = syn_findhl(func);
+	if (i >= 0) {
+		hls[i].pat = reg;
+		syn_reload = reload;
+	}
+	return i;
+}
+
 void syn_init(void)
 {
 	char *pats[ftslen];
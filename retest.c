@@ -0,0 +1,190 @@
+/*
+ * Regex conformance and throughput driver
+ *
+ * Runs regex.c outside the editor: checks the matches and groups of
+ * the patterns in tests[] and reports the matching speed of each
+ * pattern class over the lines of a file.
+ *
+ * usage: ./retest [file]	(default: vi.c)
+ */
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "vi.h"
+#include "regex.c"
+#include "uc.c"
+
+void *emalloc(size_t size)
+{
+	void *p;
+	if (!(p = malloc(size))) {
+		fprintf(stderr, "malloc: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+void *erealloc(void *p, size_t size)
+{
+	if (!(p = realloc(p, size))) {
+		fprintf(stderr, "realloc: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/* pattern, flags, input, number of groups and their expected offsets */
+static struct retest {
+	char *pat;
+	int flg;
+	char *s;
+	int n;
+	int grps[8];
+} tests[] = {
+	{"abc", 0, "xabcx", 1, {1, 4}},
+	{"abc", 0, "xabx", 1, {-1, -1}},
+	{"a.c", 0, "abbc adc", 1, {5, 8}},
+	{"ab*c", 0, "ac", 1, {0, 2}},
+	{"ab+c", 0, "ac abbc", 1, {3, 7}},
+	{"ab?c", 0, "abbc abc", 1, {5, 8}},
+	{"a{2,3}", 0, "aaaa", 1, {0, 3}},
+	{"a{2}", 0, "a aa", 1, {2, 4}},
+	{"a.*b", 0, "axbxb", 1, {0, 5}},
+	{"a.*?b", 0, "axbxb", 1, {0, 3}},
+	{"a.+?b", 0, "abxb", 1, {0, 4}},
+	{"[a-c]+", 0, "xxbcaz", 1, {2, 5}},
+	{"[^a-c]+", 0, "abxyc", 1, {2, 4}},
+	{"[0-9]+\\.[0-9]*", 0, "v 12.5", 1, {2, 6}},
+	{"int|char|void", 0, "static void f", 1, {7, 11}},
+	{"(if|else)(for)?", 0, "elsefor", 3, {0, 7, 0, 4, 4, 7}},
+	{"(a)(b)?", 0, "ac", 3, {0, 1, 0, 1, -1, -1}},
+	{"(a|ab)(c|bcd)(d*)", 0, "abcd", 4, {0, 4, 0, 1, 1, 4, 4, 4}},
+	{"(?:ab)+", 0, "ababx", 1, {0, 4}},
+	{"(a*)*b", 0, "aab", 2, {0, 3, 0, 2}},
+	{"([a-z]+)\\(([^)]*)\\)", 0, "x = f(a, b);", 3, {4, 11, 4, 5, 6, 10}},
+	{"^abc", 0, "abc", 1, {0, 3}},
+	{"^abc", 0, "xabc", 1, {-1, -1}},
+	{"^abc", REG_NOTBOL, "abc", 1, {-1, -1}},
+	{"abc$", 0, "abcabc", 1, {3, 6}},
+	{"b$", REG_NEWLINE, "ab\nb", 1, {1, 2}},
+	{"^b", REG_NEWLINE, "a\nb", 1, {-1, -1}},
+	{"\\<in", 0, "bin in", 1, {4, 6}},
+	{"t\\>", 0, "tt it", 1, {1, 2}},
+	{"ABC", REG_ICASE, "xabc", 1, {1, 4}},
+	{"[a-c]+", REG_ICASE, "xABC", 1, {1, 4}},
+	{"\327\251\327\234+", 0, "a \327\251\327\234\327\234", 1, {2, 8}},
+	{"[\327\220-\327\252]+", 0, "ab\327\251\327\234c", 1, {2, 6}},
+	{".b", 0, "\327\251b", 1, {0, 3}},
+};
+
+/* pattern classes for the throughput runs */
+static struct rebench {
+	char *cls;
+	char *pats[4];
+} benches[] = {
+	{"literal", {"static", "return", "xyzzy"}},
+	{"class", {"[a-z]+_[a-z0-9]+", "[0-9]+[.][0-9]*", "[^ \t;]+;"}},
+	{"alternation", {"int|char|void|long|short|static|struct|return",
+		"(if|else|for|while|do|switch|case|goto)"}},
+	{"anchored", {"^\t+return", "^#include", ";$"}},
+	{"groups", {"([a-z]+)\\(([^)]*)\\)", "(a|b)(c|d)*(e)", "(x?)(y?)z"}},
+};
+
+static int conform(void)
+{
+	int i, j, fails = 0, grps[8], ret;
+	rset *rs;
+	for (i = 0; i < LEN(tests); i++) {
+		struct retest *t = &tests[i];
+		if (!(rs = rset_make(1, &t->pat, t->flg & REG_ICASE))) {
+			printf("FAIL %s: does not compile\n", t->pat);
+			fails++;
+			continue;
+		}
+		ret = rset_find(rs, t->s, t->n, grps, t->flg);
+		for (j = 0; j < t->n * 2; j++)
+			if (ret < 0 ? t->grps[0] >= 0 : grps[j] != t->grps[j])
+				break;
+		if (j < t->n * 2) {
+			printf("FAIL %s on \"%s\":", t->pat, t->s);
+			for (j = 0; ret >= 0 && j < t->n * 2; j++)
+				printf(" %d", grps[j]);
+			printf(ret < 0 ? " no match\n" : "\n");
+			fails++;
+		}
+		rset_free(rs);
+	}
+	printf("conformance: %d of %d passed\n", LEN(tests) - fails, LEN(tests));
+	return fails;
+}
+
+static long now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* find all matches of rs in the lines of buf, like :s/pat//g */
+static long scan(rset *rs, char *buf)
+{
+	int grps[2], flg;
+	long cnt = 0;
+	char *s = buf, *e;
+	for (; *s; s = e) {
+		e = strchr(s, '\n');
+		e = e ? e + 1 : s + strlen(s);
+		for (flg = REG_NEWLINE; s < e; flg |= REG_NOTBOL) {
+			if (rset_find(rs, s, 1, grps, flg) < 0)
+				break;
+			cnt++;
+			s += grps[1] > 0 ? grps[1] : 1;
+		}
+	}
+	return cnt;
+}
+
+static void bench(char *buf, long len)
+{
+	long beg, t, cnt, runs;
+	int i, j;
+	rset *rs;
+	for (i = 0; i < LEN(benches); i++) {
+		for (j = 0; j < LEN(benches[i].pats) && benches[i].pats[j]; j++) {
+			if (!(rs = rset_make(1, &benches[i].pats[j], 0)))
+				continue;
+			beg = now();
+			for (runs = 0; !runs || now() - beg < 200000; runs++)
+				cnt = scan(rs, buf);
+			t = now() - beg;
+			printf("%-12s %-48s %8.1f MB/s %8ld matches\n", benches[i].cls,
+				benches[i].pats[j], (double) len * runs / t, cnt);
+			rset_free(rs);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char *path = argc > 1 ? argv[1] : "vi.c";
+	char *buf;
+	long len = 0, sz = 1 << 20, n;
+	int fd, fails = conform();
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "retest: cannot open %s\n", path);
+		return EXIT_FAILURE;
+	}
+	buf = emalloc(sz);
+	while ((n = read(fd, buf + len, sz - 1 - len)) > 0)
+		if ((len += n) == sz - 1)
+			buf = erealloc(buf, sz *= 2);
+	buf[len] = '\0';
+	close(fd);
+	bench(buf, len);
+	free(buf);
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,8 +1,42 @@
 sbuf *term_sbuf;
 int term_record;
+int term_null;				/* count but discard output (-b) */
 int xrows, xcols;
+long term_nwrites, term_nbytes;		/* write() calls and bytes written */
+long term_nframes;			/* number of committed frames */
+long term_fwrites, term_fbytes;		/* write() calls and bytes of the last frame */
+static long term_fw0, term_fb0;		/* term_nwrites and term_nbytes at frame start */
+static int term_sync;			/* inside a synchronized update */
+long term_hist[PF_CNT][PF_BKT];		/* phase latencies in log2 microseconds */
+long term_keyt;				/* when the last key was read; 0 if painted */
 static struct termios termios;
 
+/* monotonic time in microseconds */
+long term_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* add the time since beg to the histogram of phase */
+void term_time(int phase, long beg)
+{
+	long t = term_clock() - beg;
+	int b = 0;
+	for (; t > 0 && b < PF_BKT - 1; t >>= 1)
+		b++;
+	term_hist[phase][b]++;
+}
+
+static void term_write(char *s, int n)
+{
+	if (!term_null)
+		write(1, s, n);
+	term_nwrites++;
+	term_nbytes += n;
+}
+
 void term_init(void)
 {
 	if (xvis & 2 && xvis & 4)
@@ -24,13 +58,14 @@ void term_init(void)
 	}
 	xcols = xcols ? xcols : 80;
 	xrows = xrows ? xrows : 25;
-	term_out("\33[m");
+	term_out("\33[m\33[?2004h");	/* enable bracketed paste */
 }
 
 void term_done(void)
 {
 	if (!term_sbuf)
 		return;
+	term_out("\33[?2004l");
 	term_commit();
 	sbuf_free(term_sbuf)
 	tcsetattr(0, 0, &termios);
@@ -38,8 +73,7 @@ void term_done(void)
 
 void term_clean(void)
 {
-	write(1, "\x1b[2J", 4);	/* clear screen */
-	write(1, "\x1b[H", 3);	/* cursor topleft */
+	term_out("\x1b[2J\x1b[H");	/* clear screen; cursor topleft */
 }
 
 void term_suspend(void)
@@ -49,11 +83,41 @@ void term_suspend(void)
 	term_init();
 }
 
+/* start a frame: record all output and write it in term_commit() */
+void term_frame(void)
+{
+	if (term_sync || !term_sbuf)
+		return;
+	if (term_sbuf->s_n)
+		term_commit();
+	term_record = 1;
+	term_sync = 1;
+	term_fw0 = term_nwrites;
+	term_fb0 = term_nbytes;
+	sbuf_str(term_sbuf, "\33[?2026h")
+}
+
 void term_commit(void)
 {
-	write(1, term_sbuf->s, term_sbuf->s_n);
+	long t = term_clock();
+	if (!term_sbuf)
+		return;
+	if (term_sync)
+		sbuf_str(term_sbuf, "\33[?2026l")
+	if (term_sbuf->s_n)
+		term_write(term_sbuf->s, term_sbuf->s_n);
+	term_time(PF_COMMIT, t);
+	if (term_sync) {
+		term_nframes++;
+		term_fwrites = term_nwrites - term_fw0;
+		term_fbytes = term_nbytes - term_fb0;
+		if (term_keyt)
+			term_time(PF_KEY, term_keyt);
+		term_keyt = 0;
+	}
 	sbuf_cut(term_sbuf, 0)
 	term_record = 0;
+	term_sync = 0;
 }
 
 void term_out(char *s)
@@ -61,7 +125,7 @@ void term_out(char *s)
 	if (term_record)
 		sbufn_str(term_sbuf, s)
 	else
-		write(1, s, strlen(s));
+		term_write(s, strlen(s));
 }
 
 void term_chr(int ch)
@@ -86,6 +150,19 @@ void term_room(int n)
 	term_out(cmd);
 }
 
+/* limit scrolling to rows top to bot; reset the region if top > bot */
+void term_region(int top, int bot)
+{
+	char cmd[64] = "\33[", *s = cmd + 2;
+	if (top <= bot) {
+		s = itoa(top + 1, s);
+		*s++ = ';';
+		s = itoa(bot + 1, s);
+	}
+	memcpy(s, "r", 2);
+	term_out(cmd);
+}
+
 void term_pos(int r, int c)
 {
 	char buf[64] = "\r\33[", *s;
@@ -104,15 +181,22 @@ void term_pos(int r, int c)
 	}
 }
 
-static char ibuf[4096];			/* input character buffer */
+static char *ibuf;			/* input character buffer */
+static unsigned int ibuf_sz;		/* ibuf[] size */
 static char icmd[4096];			/* read after the last term_cmd() */
 unsigned int ibuf_pos, ibuf_cnt;	/* ibuf[] position and length */
 unsigned int icmd_pos;			/* icmd[] position */
+static char *tbuf;			/* terminal input read ahead */
+static unsigned int tbuf_sz, tbuf_pos, tbuf_cnt;	/* tbuf[] size, position and length */
+static unsigned int tbuf_pbeg, tbuf_pend;	/* bracketed paste text in tbuf[] */
 
 /* read s before reading from the terminal */
 void term_push(char *s, unsigned int n)
 {
-	n = MIN(n, sizeof(ibuf) - ibuf_cnt);
+	if (ibuf_cnt + n > ibuf_sz) {
+		ibuf_sz = MAX(ibuf_sz * 2, ibuf_cnt + n);
+		ibuf = erealloc(ibuf, ibuf_sz);
+	}
 	memcpy(ibuf + ibuf_cnt, s, n);
 	ibuf_cnt += n;
 }
@@ -125,60 +209,162 @@ char *term_cmd(int *n)
 	return icmd;
 }
 
-int term_read(void)
+/* append all available terminal input to tbuf[]; wait at most ms milliseconds */
+static int term_fill(int ms)
 {
 	struct pollfd ufds[1];
 	int n;
+	/* show what has been recorded before waiting */
+	if (term_record)
+		term_commit();
+	ufds[0].fd = STDIN_FILENO;
+	ufds[0].events = POLLIN;
+	if (poll(ufds, 1, ms) <= 0)
+		return -1;
+	if (tbuf_cnt + 4096 > tbuf_sz) {
+		tbuf_sz = MAX(tbuf_sz * 2, tbuf_cnt + 4096);
+		tbuf = erealloc(tbuf, tbuf_sz);
+	}
+	if ((n = read(STDIN_FILENO, tbuf + tbuf_cnt, tbuf_sz - tbuf_cnt)) <= 0) {
+		xquit = !isatty(STDIN_FILENO);
+		return -1;
+	}
+	tbuf_cnt += n;
+	return n;
+}
+
+/* find and remove the marker m in tbuf[] after *i; read more if wait */
+static int term_marker(char *m, unsigned int *i, int wait)
+{
+	do {
+		for (; *i + 6 <= tbuf_cnt; ++*i)
+			if (tbuf[*i] == '\33' && !memcmp(tbuf + *i, m, 6)) {
+				memmove(tbuf + *i, tbuf + *i + 6, tbuf_cnt - *i - 6);
+				tbuf_cnt -= 6;
+				return 1;
+			}
+	} while (wait && term_fill(-1) > 0);
+	return 0;
+}
+
+/* if a paste starts at tbuf_pos, remove its markers and note where it is */
+static int term_bracket(void)
+{
+	unsigned int i = tbuf_pos, n;
+	/* a marker cut by read(); a lone escape waits only for ready input */
+	while ((n = tbuf_cnt - tbuf_pos) < 6 && !memcmp(tbuf + tbuf_pos, "\33[200~", n))
+		if (term_fill(n > 1 ? -1 : 0) <= 0)
+			return 0;
+	if (memcmp(tbuf + tbuf_pos, "\33[200~", 6))
+		return 0;
+	term_marker("\33[200~", &i, 0);
+	tbuf_pbeg = i;
+	term_marker("\33[201~", &i, 1);
+	tbuf_pend = MIN(i, tbuf_cnt);
+	return 1;
+}
+
+/* if the last character read was pasted, return the rest of the pasted text */
+char *term_paste(int *n)
+{
+	char *s;
+	if (ibuf_pos < ibuf_cnt || tbuf_pos <= tbuf_pbeg || tbuf_pos > tbuf_pend)
+		return NULL;
+	s = tbuf + tbuf_pos;
+	*n = tbuf_pend - tbuf_pos;
+	memcpy(icmd + icmd_pos, s, MIN((unsigned int) *n, sizeof(icmd) - icmd_pos));
+	icmd_pos += MIN((unsigned int) *n, sizeof(icmd) - icmd_pos);
+	tbuf_pos = tbuf_pend;
+	return s;
+}
+
+int term_read(void)
+{
 	if (ibuf_pos >= ibuf_cnt) {
-		ufds[0].fd = STDIN_FILENO;
-		ufds[0].events = POLLIN;
-		if (poll(ufds, 1, -1) <= 0)
-			return -1;
-		/* read a single input character */
-		if ((n = read(STDIN_FILENO, ibuf, 1)) <= 0) {
-			xquit = !isatty(STDIN_FILENO);
-			return -1;
-		}
-		ibuf_cnt = n;
+		do {
+			while (tbuf_pos >= tbuf_cnt) {
+				tbuf_pos = tbuf_cnt = 0;
+				tbuf_pbeg = tbuf_pend = 0;
+				if (term_fill(-1) < 0)
+					return -1;
+			}
+		} while (tbuf[tbuf_pos] == '\33' && (tbuf_pos < tbuf_pbeg ||
+				tbuf_pos >= tbuf_pend) && term_bracket());
+		/* hand out the read ahead one character at a time, so that
+		 * input given to term_push() comes before it */
+		ibuf_cnt = 0;
+		term_push(tbuf + tbuf_pos++, 1);
 		ibuf_pos = 0;
+		term_keyt = term_clock();
 	}
 	if (icmd_pos < sizeof(icmd))
 		icmd[icmd_pos++] = (unsigned char)ibuf[ibuf_pos];
 	return (unsigned char)ibuf[ibuf_pos++];
 }
 
-/* return a static string that changes text attributes to att */
-char *term_att(int att)
-{
-	static char buf[128];
-	char *s = buf;
-	int fg = SYN_FG(att);
-	int bg = SYN_BG(att);
-	*s++ = '\x1b';
-	*s++ = '[';
-	if (att & SYN_BD)
-		{*s++ = ';'; *s++ = '1';}
-	if (att & SYN_IT)
-		{*s++ = ';'; *s++ = '3';}
-	else if (att & SYN_RV)
-		{*s++ = ';'; *s++ = '7';}
-	if (SYN_FGSET(att)) {
-		*s++ = ';';
-		if ((fg & 0xff) < 8)
-			s = itoa(30 + (fg & 0xff), s);
-		else
-			s = itoa(fg & 0xff, (char*)memcpy(s, "38;5;", 5)+5);
-	}
-	if (SYN_BGSET(att)) {
-		*s++ = ';';
-		if ((bg & 0xff) < 8)
-			s = itoa(40 + (bg & 0xff), s);
-		else
-			s = itoa(bg & 0xff, (char*)memcpy(s, "48;5;", 5)+5);
-	}
-	s[0] = 'm';
-	s[1] = '\0';
-	return buf;
+static char *term_code(char *s, int code)
+{
+	*s++ = ';';
+	return itoa(code, s);
+}
+
+static char *term_color(char *s, int base, int c)
+{
+	*s++ = ';';
+	if (c < 8)
+		return itoa(base + c, s);
+	s = itoa(base + 8, s);
+	memcpy(s, ";5;", 3);
+	return itoa(c, s + 3);
+}
+
+/* append the sgr parameters that change text attributes from old to att */
+static char *term_sgr(char *s, int att, int old)
+{
+	int rv = att & SYN_IT ? 0 : att & SYN_RV;
+	int orv = old & SYN_IT ? 0 : old & SYN_RV;
+	if ((att ^ old) & SYN_BD)
+		s = term_code(s, att & SYN_BD ? 1 : 22);
+	if ((att ^ old) & SYN_IT)
+		s = term_code(s, att & SYN_IT ? 3 : 23);
+	if (!rv != !orv)
+		s = term_code(s, rv ? 7 : 27);
+	if (SYN_FGSET(att) && (!SYN_FGSET(old) || SYN_FG(att) != SYN_FG(old)))
+		s = term_color(s, 30, SYN_FG(att));
+	else if (!SYN_FGSET(att) && SYN_FGSET(old))
+		s = term_code(s, 39);
+	if (SYN_BGSET(att) && (!SYN_BGSET(old) || SYN_BG(att) != SYN_BG(old)))
+		s = term_color(s, 40, SYN_BG(att));
+	else if (!SYN_BGSET(att) && SYN_BGSET(old))
+		s = term_code(s, 49);
+	return s;
+}
+
+/* return a static string that changes text attributes from old to att */
+char *term_att(int att, int old)
+{
+	static struct {
+		int att, old;
+		char s[64];
+	} cache[64];	/* the zeroed entries map (0, 0) to "" */
+	char full[64], delta[64], *s;
+	int i = ((unsigned int) att * 31 + (unsigned int) old) % LEN(cache);
+	if (cache[i].att == att && cache[i].old == old)
+		return cache[i].s;
+	/* an empty first parameter resets all attributes */
+	s = term_sgr(full, att, 0);
+	memcpy(s, "m", 2);
+	s = term_sgr(delta, att, old);
+	memcpy(s, "m", 2);
+	cache[i].att = att;
+	cache[i].old = old;
+	if (s == delta)
+		cache[i].s[0] = '\0';
+	else if (s - delta - 1 <= (int) strlen(full))
+		memcpy((char*)memcpy(cache[i].s, "\33[", 2) + 2, delta + 1, s - delta + 1);
+	else
+		memcpy((char*)memcpy(cache[i].s, "\33[", 2) + 2, full, strlen(full) + 1);
+	return cache[i].s;
 }
 
 static int cmd_make(char **argv, int *ifd, int *ofd)
@@ -328,3 +514,75 @@ int cmd_exec(char *cmd)
 	cmd_pipe(cmd, NULL, 0);
 	return 0;
 }
+
+/* the number of online processors */
+int cmd_ncpu(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+#else
+	return 1;
+#endif
+}
+
+/* run fn(i, out[i], arg) for i in [0, n) in forked processes; out[] get their output;
+ * return nonzero if a worker failed or its output was cut short */
+int cmd_fork(int n, void (*fn)(int i, sbuf *sb, void *arg), void *arg, sbuf **out)
+{
+	struct pollfd fds[n];
+	char buf[4096];
+	int pids[n], pfd[2], i, ret, st, left = 0, err = 0;
+	for (i = 0; i < n; i++) {
+		sbuf_make(out[i], 4096)
+		fds[i].fd = -1;
+		fds[i].events = POLLIN;
+		pids[i] = -1;
+		if (pipe(pfd) < 0)
+			continue;
+		if (!(pids[i] = fork())) {
+			close(pfd[0]);
+			fn(i, out[i], arg);
+			for (ret = 0; ret < out[i]->s_n;) {
+				int nw = write(pfd[1], out[i]->s + ret, out[i]->s_n - ret);
+				if (nw <= 0)
+					_exit(1);
+				ret += nw;
+			}
+			_exit(0);
+		}
+		close(pfd[1]);
+		if (pids[i] < 0)
+			close(pfd[0]);
+		else {
+			fds[i].fd = pfd[0];
+			left++;
+		}
+	}
+	for (i = 0; i < n; i++)	/* could not fork; do it here */
+		if (pids[i] < 0)
+			fn(i, out[i], arg);
+	while (left && poll(fds, n, -1) >= 0) {
+		for (i = 0; i < n; i++) {
+			if (fds[i].fd < 0 || !fds[i].revents)
+				continue;
+			if ((ret = read(fds[i].fd, buf, sizeof(buf))) > 0) {
+				sbuf_mem(out[i], buf, ret)
+			} else {
+				err |= ret < 0;
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				left--;
+			}
+		}
+	}
+	for (i = 0; i < n; i++)	/* poll() failed; workers see a closed pipe */
+		if (fds[i].fd >= 0)
+			close(fds[i].fd);
+	err |= left > 0;
+	for (i = 0; i < n; i++)
+		if (pids[i] > 0 && (waitpid(pids[i], &st, 0) < 0 ||
+				!WIFEXITED(st) || WEXITSTATUS(st)))
+			err = 1;
+	return err;
+}
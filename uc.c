@@ -18,12 +18,40 @@ unsigned char utf8_length[256] = {
 	/* F */ 4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1, 1, 1, 1, 1, 1
 };
 
+#define UC_ONES		((unsigned long) -1 / 0xff)
+#define UC_HIGHS	(UC_ONES * 0x80)
+
+/* the length of the leading run of ascii bytes (excluding tabs if notab) in s[0..n) */
+int uc_ascii(char *s, int n, int notab)
+{
+	unsigned long w, t;
+	int i = 0;
+	for (; i + (int) sizeof(w) <= n; i += sizeof(w)) {
+		memcpy(&w, s + i, sizeof(w));
+		t = w ^ (UC_ONES * '\t');
+		t = notab ? (t - UC_ONES) & ~t : 0;
+		if ((w | t) & UC_HIGHS)
+			break;
+	}
+	while (i < n && !(s[i] & 0x80) && (!notab || s[i] != '\t'))
+		i++;
+	return i;
+}
+
 /* the number of utf-8 characters in s */
 int uc_slen(char *s)
 {
-	int n;
-	for (n = 0; *s; n++)
-		s = uc_end(s) + 1;
+	char *e = s + strlen(s);
+	int n = 0, a;
+	while (s < e) {
+		a = uc_ascii(s, e - s, 0);
+		s += a;
+		n += a;
+		if (s < e) {
+			s = uc_end(s) + 1;
+			n++;
+		}
+	}
 	return n;
 }
 
@@ -69,26 +97,36 @@ char *uc_lastline(char *s)
 /* allocate and return an array for the characters in s */
 char **uc_chop(char *s, int *n)
 {
-	char **chrs;
-	int i;
+	char **chrs, *e;
+	int i = 0, a;
 	*n = uc_slen(s);
 	chrs = emalloc((*n + 1) * sizeof(chrs[0]));
-	for (i = 0; i < *n + 1; i++) {
-		chrs[i] = s;
-		s = uc_next(s);
+	e = s + strlen(s);
+	while (i < *n) {
+		for (a = i + uc_ascii(s, e - s, 0); i < a; i++)
+			chrs[i] = s++;
+		if (i < *n) {
+			chrs[i++] = s;
+			s = uc_next(s);
+		}
 	}
+	chrs[i] = s;
 	return chrs;
 }
 
 char *uc_chr(char *s, int off)
 {
-	int i = 0;
+	int i = 0, a;
 	if (!s)
 		return "";
 	while (*s) {
-		if (i++ == off)
-			return s;
+		a = uc_ascii(s, strnlen(s, off - i), 0);
+		s += a;
+		i += a;
+		if (!*s || i == off)
+			break;
 		s = uc_next(s);
+		i++;
 	}
 	return off < 0 || i == off ? s : "";
 }
@@ -97,9 +135,16 @@ char *uc_chr(char *s, int off)
 int uc_off(char *s, int off)
 {
 	char *e = s + off;
-	int i;
-	for (i = 0; s < e && *s; i++)
-		s = uc_next(s);
+	int i = 0, a;
+	while (s < e && *s) {
+		a = uc_ascii(s, strnlen(s, e - s), 0);
+		s += a;
+		i += a;
+		if (s < e && *s) {
+			s = uc_next(s);
+			i++;
+		}
+	}
 	return i;
 }
 
@@ -145,14 +190,12 @@ int uc_isdigit(char *s)
 	return c <= 0x7f && isdigit(c);
 }
 
-int uc_kind(char *c)
-{
-	if (uc_isspace(c))
-		return 0;
-	if (uc_isalpha(c) || uc_isdigit(c) || c[0] == '_')
-		return 1;
-	return 2;
-}
+/* character classes stored in uc_tab[] */
+#define UC_DW		0x01	/* double-width */
+#define UC_SP		0x02	/* ascii space */
+#define UC_BELL		0x04	/* nonprintable */
+#define UC_ACOMB	0x08	/* Arabic combining */
+#define UC_WD		0x10	/* word character: alphanumeric, _ or not ascii */
 
 #define UC_R2L(ch)	(((ch) & 0xff00) == 0x0600 || \
 			((ch) & 0xfffc) == 0x200c || \
@@ -217,19 +260,16 @@ static struct achar {
 
 static struct achar *find_achar(unsigned int c)
 {
-	int h, m, l;
-	h = LEN(achars);
-	l = 0;
-	/* using binary search to find c */
-	while (l < h) {
-		m = (h + l) >> 1;
-		if (achars[m].c == c)
-			return &achars[m];
-		if (c < achars[m].c)
-			h = m;
-		else
-			l = m + 1;
-	}
+	static unsigned char idx[256];	/* achars[] index + 1 of 0x06xx characters */
+	int i;
+	if (!idx[0x21])
+		for (i = 0; i < LEN(achars) && achars[i].c < 0x0700; i++)
+			idx[achars[i].c & 0xff] = i + 1;
+	if ((c & ~0xffu) == 0x0600)
+		return idx[c & 0xff] ? &achars[idx[c & 0xff] - 1] : NULL;
+	/* ZWNJ and ZWJ are the last two entries */
+	if (c - 0x200c < 2)
+		return &achars[LEN(achars) - 2 + (c - 0x200c)];
 	return NULL;
 }
 
@@ -277,11 +317,11 @@ static int uc_cshape(int cur, int prev, int next)
  * + 0x0655: hamza below
  * + 0x0670: superscript alef
  */
+static int uc_class(int c);
+
 int uc_acomb(int c)
 {
-	return (c >= 0x064b && c <= 0x0655) ||		/* the standard diacritics */
-		(c >= 0xfc5e && c <= 0xfc63) ||		/* shadda ligatures */
-		c == 0x0670;				/* superscript alef */
+	return uc_class(c) & UC_ACOMB;
 }
 
 static void uc_cput(char *d, int c)
@@ -333,6 +373,30 @@ char *uc_shape(char *beg, char *s)
 	return out;
 }
 
+/* shape the n characters of a line in chrs; shp[i] is empty if unchanged */
+void uc_shapeln(char **chrs, int n, char (*shp)[4])
+{
+	int i, j = 0, c, prev = 0, next = 0;
+	for (i = 0; i < n; i++) {
+		uc_code(c, chrs[i])
+		shp[i][0] = '\0';
+		if (c && UC_R2L(c)) {
+			if (j <= i) {
+				for (j = i + 1, next = 0; j < n; j++) {
+					uc_code(next, chrs[j])
+					if (!uc_acomb(next))
+						break;
+				}
+				if (j == n)
+					next = 0;
+			}
+			uc_cput(shp[i], uc_cshape(c, prev, next));
+		}
+		if (!uc_acomb(c))
+			prev = c;
+	}
+}
+
 static int dwchars[][2] = {
 	{0x1100, 0x115f}, {0x11a3, 0x11a7}, {0x11fa, 0x11ff}, {0x2329, 0x232a},
 	{0x2e80, 0x2e99}, {0x2e9b, 0x2ef3}, {0x2f00, 0x2fd5}, {0x2ff0, 0x2ffb},
@@ -551,30 +615,62 @@ static int find(int c, int tab[][2], int n)
 	return 0;
 }
 
-/* double-width characters */
-static int uc_isdw(int c)
+static int uc_isacomb(int c)
+{
+	return (c >= 0x064b && c <= 0x0655) ||		/* the standard diacritics */
+		(c >= 0xfc5e && c <= 0xfc63) ||		/* shadda ligatures */
+		c == 0x0670;				/* superscript alef */
+}
+
+static int uc_isprintable(int c)
 {
-	return find(c, dwchars, LEN(dwchars));
+	if (c == ' ' || c == '\t' || c == '\n' || (c <= 0x7f && isprint(c)))
+		return 1;
+	return !find(c, zwchars, LEN(zwchars)) && !find(c, bchars, LEN(bchars));
 }
 
-/* zero-width and combining characters */
-static int uc_iszw(int c)
+/*
+ * Two-level lookup table of character classes: uc_tab[c >> 8] points
+ * to a block of 256 class bytes.  The blocks are computed from the range
+ * tables above the first time a character of that block is seen, so the
+ * binary searches run once per block instead of once per character.
+ */
+static unsigned char *uc_tab[(0x10ffff >> 8) + 1];
+
+static int uc_class(int c)
 {
-	return find(c, zwchars, LEN(zwchars));
+	unsigned char *blk;
+	int i, cp;
+	if ((unsigned int)c > 0x10ffff)
+		return 0;
+	if (!(blk = uc_tab[c >> 8])) {
+		blk = emalloc(256);
+		for (i = 0, cp = c & ~0xff; i < 256; i++, cp++)
+			blk[i] = (find(cp, dwchars, LEN(dwchars)) ? UC_DW : 0) |
+				(cp <= 0x7f && isspace(cp) ? UC_SP : 0) |
+				(cp > 0x7f || isalnum(cp) || cp == '_' ? UC_WD : 0) |
+				(uc_isprintable(cp) ? 0 : UC_BELL) |
+				(uc_isacomb(cp) ? UC_ACOMB : 0);
+		uc_tab[c >> 8] = blk;
+	}
+	return blk[c & 0xff];
 }
 
 /* nonprintable characters */
 int uc_isbell(int c)
 {
-	if (c == ' ' || c == '\t' || c == '\n' || (c <= 0x7f && isprint(c)))
-		return 0;
-	return uc_iszw(c) || find(c, bchars, LEN(bchars));
+	return uc_class(c) & UC_BELL;
+}
+
+/* 0 for spaces, 1 for word characters (all non-ascii) and 2 for others */
+int uc_kind(char *c)
+{
+	int cls = uc_class((unsigned char) *c);
+	return cls & UC_SP ? 0 : (cls & UC_WD ? 1 : 2);
 }
 
 /* printing width */
 int uc_wid(int c)
 {
-	if (!uc_isdw(c) || uc_isbell(c) || uc_acomb(c))
-		return 1;
-	return 2;
+	return (uc_class(c) & (UC_DW | UC_BELL | UC_ACOMB)) == UC_DW ? 2 : 1;
 }
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <poll.h>
 #include <termios.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
@@ -166,7 +167,9 @@ static void vi_drawrow(int row)
 		c = itoa(abs(xrow-row+movedown), tmp+l2+i);
 		*c++ = ' ';
 		memcpy(c, s+i, l1-i);
+		led_ovlrow = -2;
 		led_reprint(tmp, row - xtop);
+		led_ovlrow = -1;
 	}
 	if (*vi_word && row == xrow+1) {
 		last_row:;
@@ -174,7 +177,9 @@ static void vi_drawrow(int row)
 		int nrow = xrow;
 		c = lbuf_get(xb, xrow);
 		if (!c || *c == '\n') {
+			led_ovlrow = s != ch1 ? row - movedown : -1;
 			led_print(s, row - xtop);
+			led_ovlrow = -1;
 			return;
 		}
 		char tmp[xcols+3];
@@ -209,8 +214,11 @@ static void vi_drawrow(int row)
 		restore(xorder)
 		restore(syn_blockhl)
 		restore(xtd)
-	} else if (!lnnum)
+	} else if (!lnnum) {
+		led_ovlrow = row - movedown;
 		led_print(s, row - xtop);
+		led_ovlrow = -1;
+	}
 	if (row+1 == MIN(xtop + xrows, lbuf_len(xb)+movedown))
 		movedown = 0;
 }
@@ -228,8 +236,15 @@ static void vi_drawagain(void)
 static void vi_drawupdate(int otop)
 {
 	int i = otop - xtop;
+	if (abs(i) >= xrows) {
+		vi_drawagain();
+		return;
+	}
+	/* scroll the text rows only, keeping the status row in place */
+	term_region(0, xrows - 1);
 	term_pos(0, 0);
 	term_room(i);
+	term_region(0, -1);
 	syn_scdir(i > 1 || i < -1 ? -1 : i);
 	if (i < 0) {
 		int n = MIN(-i, xrows);
@@ -265,7 +280,9 @@ static void vi_wait(void)
 {
 	if (vi_printed > 1) {
 		strcpy(vi_msg, "[any key to continue] ");
+		term_frame();
 		vi_drawmsg();
+		term_commit();
 		vi_char();
 		vi_msg[0] = '\0';
 		vi_mod |= 1;
@@ -276,6 +293,7 @@ static void vi_wait(void)
 static char *vi_prompt(char *msg, char *insert, int *kmap)
 {
 	char *r, *s;
+	term_frame();
 	term_pos(xrows, led_pos(msg, 0));
 	syn_setft("/-");
 	s = led_prompt(msg, "", insert, kmap);
@@ -325,8 +343,10 @@ void ex_show(char *msg)
 		snprintf(vi_msg, sizeof(vi_msg), "%s", msg);
 	} else if (term_sbuf) {
 		syn_setft("/-");
+		term_frame();
 		led_reprint(msg, -1);
 		term_chr('\n');
+		term_commit();
 		syn_setft(ex_ft);
 	} else {
 		write(1, msg, dstrlen(msg, '\n'));
@@ -340,6 +360,7 @@ void ex_print(char *line)
 	syn_blockhl = 0;
 	if (!(xvis & 4)) {
 		vi_printed += line ? 1 : 2;
+		term_frame();
 		if (line) {
 			snprintf(vi_msg, sizeof(vi_msg), "%s", line);
 			syn_setft("/-");
@@ -347,6 +368,7 @@ void ex_print(char *line)
 			syn_setft(ex_ft);
 		}
 		term_chr('\n');
+		term_commit();
 	} else if (line)
 		ex_show(line);
 }
@@ -534,13 +556,13 @@ static int vi_motionln(int *row, int cmd)
 	return c;
 }
 
-static char *vi_curword(struct lbuf *lb, int row, int off, int n, int x)
+/* the n words at off of line row span [*b, *e) */
+static int vi_wordspan(struct lbuf *lb, int row, int off, int n, char **b, char **e)
 {
-	sbuf *sb;
 	char *ln = lbuf_get(lb, row);
 	char *beg, *end;
 	if (!ln || !n)
-		return NULL;
+		return 1;
 	beg = uc_chr(ln, ren_noeol(ln, off));
 	end = beg;
 	while (beg > ln && uc_kind(uc_beg(ln, beg - 1)) == 1)
@@ -550,6 +572,17 @@ static char *vi_curword(struct lbuf *lb, int row, int off, int n, int x)
 			end = uc_next(end);
 	}
 	if (beg >= --end)
+		return 1;
+	*b = beg;
+	*e = end;
+	return 0;
+}
+
+static char *vi_curword(struct lbuf *lb, int row, int off, int n, int x)
+{
+	sbuf *sb;
+	char *beg, *end;
+	if (vi_wordspan(lb, row, off, n, &beg, &end))
 		return NULL;
 	sbuf_make(sb, (end - beg)+64)
 	if (n > 1) {
@@ -599,6 +632,7 @@ void vi_regput(int c, const char *s, int ln)
 
 static void vi_regprint(void)
 {
+	term_frame();
 	term_pos(xrows, led_pos(vi_msg, 0));
 	xleft = (xcols / 2) * vi_arg1;
 	for (int i = 1; i < LEN(regs); i++) {
@@ -615,64 +649,571 @@ char *fs_exdir;
 static int fspos;
 static int fsdir;
 
-static char *file_calc(char *path)
+#define FDOPEN		64	/* most directories a :fd walk keeps open */
+#define FDSPLIT		8	/* directories handed to each :fd scanning process */
+#define FDWORKERS	16	/* maximum number of first :fd scanning processes */
+
+/* a directory of the :fd index */
+struct fdent {
+	char *path;
+	char *names;		/* NUL-terminated files, then subdirectories */
+	int nfiles, ndirs;
+	long ctime;		/* status change time when listed or -1 */
+	int seen;		/* reached by the last walk */
+};
+
+static struct fdent **fd_tab;	/* directories hashed by path */
+static int fd_tabsz, fd_n, fd_seen, fd_dirty;
+static char *fd_key;		/* working directory and root of the index */
+
+static struct fdent **fd_slot(char *path)
+{
+	int m = fd_tabsz - 1, i = bufs_hash(path, strlen(path)) & m;
+	while (fd_tab[i] && strcmp(fd_tab[i]->path, path))
+		i = (i + 1) & m;
+	return &fd_tab[i];
+}
+
+static void fd_free(struct fdent *e)
+{
+	free(e->path);
+	free(e->names);
+	free(e);
+}
+
+static void fd_add(struct fdent *e)
+{
+	struct fdent **old = fd_tab, **s;
+	int i, n = fd_tabsz;
+	if ((fd_n + 1) * 2 > fd_tabsz) {
+		fd_tabsz = fd_tabsz ? fd_tabsz * 2 : 1024;
+		fd_tab = emalloc(fd_tabsz * sizeof(fd_tab[0]));
+		memset(fd_tab, 0, fd_tabsz * sizeof(fd_tab[0]));
+		for (i = 0; i < n; i++)
+			if (old[i])
+				*fd_slot(old[i]->path) = old[i];
+		free(old);
+	}
+	s = fd_slot(e->path);
+	if (*s)
+		fd_free(*s);
+	else
+		fd_n++;
+	*s = e;
+}
+
+/* drop the directories the last walk did not reach, or all of them */
+static void fd_prune(int all)
+{
+	struct fdent **old = fd_tab;
+	int i, n = fd_tabsz;
+	fd_tab = NULL;
+	fd_tabsz = 0;
+	fd_n = 0;
+	for (i = 0; i < n; i++) {
+		if (old[i] && !all && old[i]->seen == fd_seen) {
+			fd_add(old[i]);
+		} else if (old[i]) {
+			fd_free(old[i]);
+			fd_dirty = 1;
+		}
+	}
+	free(old);
+}
+
+/* read the directory at fd whose status is st */
+static struct fdent *fd_list(int fd, char *path, struct stat *st)
 {
 	struct dirent *dp;
-	struct stat statbuf;
-	int len;
-	DIR *dir = opendir(path);
-	int pathlen = strlen(path);
-	if (!dir)
-		return path + pathlen;
+	struct stat lst;
+	struct fdent *e;
+	sbuf *files, *dirs;
+	int n, type;
+	int dfd = dup(fd);
+	DIR *dir = dfd >= 0 ? fdopendir(dfd) : NULL;
+	if (!dir) {
+		if (dfd >= 0)
+			close(dfd);
+		return NULL;
+	}
+	e = emalloc(sizeof(*e));
+	e->nfiles = 0;
+	e->ndirs = 0;
+	sbuf_make(files, 1024)
+	sbuf_make(dirs, 256)
 	while ((dp = readdir(dir)) != NULL) {
-		len = strlen(dp->d_name)+1;
-		path[pathlen] = '/';
-		memcpy(&path[pathlen+1], dp->d_name, len);
-		if (fsincl && rset_find(fsincl, path, 0, NULL, 0) < 0)
+		if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
 			continue;
-		if (lstat(path, &statbuf) >= 0 && S_ISREG(statbuf.st_mode))
-			temp_write(1, path);
+		type = -1;
+#ifdef DT_UNKNOWN
+		if (dp->d_type != DT_UNKNOWN)
+			type = dp->d_type == DT_REG ? 1 : dp->d_type == DT_DIR ? 2 : 0;
+#endif
+		if (type < 0) {
+			if (fstatat(fd, dp->d_name, &lst, AT_SYMLINK_NOFOLLOW) < 0)
+				continue;
+			type = S_ISREG(lst.st_mode) ? 1 : S_ISDIR(lst.st_mode) ? 2 : 0;
+		}
+		n = strlen(dp->d_name) + 1;
+		if (type == 1) {
+			sbuf_mem(files, dp->d_name, n)
+			e->nfiles++;
+		} else if (type == 2) {
+			sbuf_mem(dirs, dp->d_name, n)
+			e->ndirs++;
+		}
 	}
 	closedir(dir);
-	path[pathlen] = '/';
-	path[pathlen+1] = '\0';
-	return path + pathlen + 1;
+	sbuf_mem(files, dirs->s, dirs->s_n)
+	sbuf_free(dirs)
+	e->names = files->s;
+	free(files);
+	e->path = uc_dup(path);
+	/* changes within the same second would go unnoticed */
+	e->ctime = st->st_ctime < time(NULL) - 1 ? st->st_ctime : -1;
+	e->seen = fd_seen;
+	fd_dirty = 1;
+	return e;
+}
+
+/* open directory name of dfd as *fd and return its entry, listing it
+ * if it has changed */
+static struct fdent *fd_get(int dfd, char *name, char *path, int *fd)
+{
+	struct fdent *e = fd_tabsz ? *fd_slot(path) : NULL;
+	struct stat st;
+	int flg = dfd == AT_FDCWD ? 0 : O_NOFOLLOW;
+	if ((*fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | flg)) < 0)
+		return NULL;
+	if (fstat(*fd, &st) >= 0) {
+		if (e && e->ctime >= 0 && e->ctime == st.st_ctime)
+			return e;
+		if ((e = fd_list(*fd, path, &st))) {
+			fd_add(e);
+			return e;
+		}
+	}
+	close(*fd);
+	return NULL;
+}
+
+/* a directory being walked */
+struct fdframe {
+	struct fdent *e;
+	char *s;		/* the next name */
+	int i;			/* the index of s in e->names */
+	int fd;			/* the open directory */
+	int len;		/* the length of its path */
+};
+
+/* append the files under root to sb, or only index them if sb is NULL */
+static int fd_walk(sbuf *sb, char *root)
+{
+	struct fdframe *st = NULL, *f;
+	struct fdent *e;
+	int n = 0, sz = 0, fd, ret;
+	char *name;
+	sbuf *path;
+	sbuf_make(path, 256)
+	sbufn_str(path, root)
+	e = fd_get(AT_FDCWD, root, path->s, &fd);
+	while (e) {
+		if (n == sz) {
+			sz = sz ? sz * 2 : 64;
+			st = erealloc(st, sz * sizeof(st[0]));
+		}
+		st[n].e = e;
+		st[n].s = e->names;
+		st[n].i = 0;
+		st[n].fd = fd;
+		st[n++].len = path->s_n;
+		e->seen = fd_seen;
+		if (n > FDOPEN) {	/* reopened through ".." when needed */
+			close(st[n - 1 - FDOPEN].fd);
+			st[n - 1 - FDOPEN].fd = -1;
+		}
+		for (e = NULL; n && !e;) {
+			f = &st[n - 1];
+			if (f->fd < 0)
+				break;
+			if (f->i == f->e->nfiles + f->e->ndirs) {
+				if (n > 1 && st[n - 2].fd < 0)
+					st[n - 2].fd = openat(f->fd, "..", O_RDONLY | O_DIRECTORY);
+				close(f->fd);
+				n--;
+				continue;
+			}
+			name = f->s;
+			f->s += strlen(name) + 1;
+			sbuf_cut(path, f->len)
+			sbuf_chr(path, '/')
+			sbufn_str(path, name)
+			if (f->i++ >= f->e->nfiles) {
+				if (!(e = fd_get(f->fd, name, path->s, &fd)))
+					break;
+			} else if (sb && (!fsincl || rset_find(fsincl, path->s, 0, NULL, 0) >= 0)) {
+				sbuf_mem(sb, path->s, path->s_n)
+				sbuf_chr(sb, '\n')
+			}
+		}
+	}
+	ret = n > 0 || !sz;	/* a directory could not be read */
+	while (n > 0)
+		if (st[--n].fd >= 0)
+			close(st[n].fd);
+	free(st);
+	sbuf_free(path)
+	return ret;
+}
+
+static void fd_dump(sbuf *sb, struct fdent *e)
+{
+	char num[64];
+	char *s = e->names;
+	int i, n = strlen(e->path) + 1;
+	sbuf_mem(sb, e->path, n)
+	n = snprintf(num, sizeof(num), "%ld %d %d", e->ctime, e->nfiles, e->ndirs) + 1;
+	sbuf_mem(sb, num, n)
+	for (i = 0; i < e->nfiles + e->ndirs; i++)
+		s += strlen(s) + 1;
+	sbuf_mem(sb, e->names, s - e->names)
+}
+
+/* add the directories in s, as written by fd_dump() */
+static void fd_load(char *s, long len)
+{
+	char *end = s + len, *p, *q, *r;
+	struct fdent *e;
+	int i;
+	while (s < end && (p = memchr(s, '\0', end - s)) &&
+			(q = memchr(p + 1, '\0', end - p - 1))) {
+		e = emalloc(sizeof(*e));
+		if (sscanf(p + 1, "%ld %d %d", &e->ctime, &e->nfiles, &e->ndirs) != 3 ||
+				e->nfiles < 0 || e->ndirs < 0) {
+			free(e);
+			return;
+		}
+		for (i = 0, r = ++q; i < e->nfiles + e->ndirs && r < end &&
+				(p = memchr(r, '\0', end - r)); i++)
+			r = p + 1;
+		if (i < e->nfiles + e->ndirs) {
+			free(e);
+			return;
+		}
+		e->names = emalloc(r - q + 1);
+		memcpy(e->names, q, r - q);
+		e->path = uc_dup(s);
+		e->seen = 0;
+		fd_add(e);
+		s = r;
+	}
+}
+
+/* the file keeping the index in $VIFDINDEX directory */
+static char *fd_file(void)
+{
+	char *dir = getenv("VIFDINDEX");
+	char name[16];
+	sbuf *sb;
+	if (!dir || !*dir)
+		return NULL;
+	snprintf(name, sizeof(name), "/%08x", bufs_hash(fd_key, strlen(fd_key)));
+	sbuf_make(sb, 256)
+	sbuf_str(sb, dir)
+	sbufn_str(sb, name)
+	sbufn_done(sb)
 }
 
+static void fd_read(void)
+{
+	char *path = fd_file(), *buf;
+	struct stat st;
+	long n = 0, nr;
+	int fd, klen = strlen(fd_key) + 1;
+	if (!path)
+		return;
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return;
+	}
+	buf = emalloc(st.st_size + 1);
+	while (n < st.st_size && (nr = read(fd, buf + n, st.st_size - n)) > 0)
+		n += nr;
+	close(fd);
+	if (n >= klen && !memcmp(buf, fd_key, klen))
+		fd_load(buf + klen, n - klen);
+	free(buf);
+}
+
+static void fd_write(void)
+{
+	char *path = fd_file(), tmp[4096];
+	long nw = 0, nc = 0;
+	sbuf *sb;
+	int fd, i;
+	if (!path)
+		return;
+	sbuf_make(sb, 1 << 16)
+	sbuf_mem(sb, fd_key, (int) strlen(fd_key) + 1)
+	for (i = 0; i < fd_tabsz; i++)
+		if (fd_tab[i])
+			fd_dump(sb, fd_tab[i]);
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) >= 0) {
+		while (nw < sb->s_n && (nc = write(fd, sb->s + nw, sb->s_n - nw)) > 0)
+			nw += nc;
+		if (close(fd) < 0 || nw < sb->s_n || rename(tmp, path) < 0)
+			unlink(tmp);
+	}
+	sbuf_free(sb)
+	free(path);
+}
+
+struct fdscan {
+	char **dirs;		/* the directories to index */
+	int ndirs, n;		/* their number and the number of workers */
+};
+
+static void fd_worker(int w, sbuf *out, void *arg)
+{
+	struct fdscan *fs = arg;
+	int i;
+	fd_seen++;
+	for (i = w; i < fs->ndirs; i += fs->n)
+		if (fd_walk(NULL, fs->dirs[i]))
+			break;
+	for (i = 0; i < fd_tabsz; i++)
+		if (fd_tab[i] && fd_tab[i]->seen == fd_seen)
+			fd_dump(out, fd_tab[i]);
+}
+
+/* index a new root in parallel; the directories near the root are
+ * dealt out to the workers in turn, so that no worker gets a single
+ * large subtree */
+static void fd_scan(char *root)
+{
+	struct fdscan fs;
+	struct fdent *e;
+	sbuf *out[FDWORKERS], *sb;
+	char **dirs, *s;
+	int i, fd, n = 0, beg = 0, sz = 64;
+	int nw = MIN(cmd_ncpu(), FDWORKERS);
+	if (nw < 2)
+		return;
+	dirs = emalloc(sz * sizeof(dirs[0]));
+	dirs[n++] = uc_dup(root);
+	while (beg < n && n - beg < nw * FDSPLIT) {
+		if (!(e = fd_get(AT_FDCWD, dirs[beg], dirs[beg], &fd)))
+			break;
+		close(fd);
+		s = e->names;
+		for (i = 0; i < e->nfiles + e->ndirs; i++, s += strlen(s) + 1) {
+			if (i < e->nfiles)
+				continue;
+			if (n == sz)
+				dirs = erealloc(dirs, (sz *= 2) * sizeof(dirs[0]));
+			sbuf_make(sb, 256)
+			sbuf_str(sb, e->path)
+			sbuf_chr(sb, '/')
+			sbufn_str(sb, s)
+			dirs[n++] = sb->s;
+			free(sb);
+		}
+		free(dirs[beg++]);
+	}
+	fs.dirs = dirs + beg;
+	fs.ndirs = n - beg;
+	fs.n = MIN(nw, fs.ndirs);
+	if (fs.n > 1) {
+		int err = cmd_fork(fs.n, fd_worker, &fs, out);
+		for (i = 0; i < fs.n; i++) {	/* after a failure dir_calc() walks it */
+			if (!err)
+				fd_load(out[i]->s, out[i]->s_n);
+			sbuf_free(out[i])
+		}
+		fd_dirty = !err;
+	}
+	for (i = beg; i < n; i++)
+		free(dirs[i]);
+	free(dirs);
+}
+
+/* list the files under path in tempbufs[1]; unchanged directories are
+ * taken from the index instead of being read again */
 void dir_calc(char *path)
 {
-	struct dirent *dirp;
-	struct stat statbuf;
-	char *ptr;
-	int i = 0;
-	char cur_dir[4096];
-	char *ptrs[1024];
-	DIR *dps[1024];
-	DIR *dp;
-	strcpy(cur_dir, path);
+	char cwd[4096];
+	sbuf *sb;
+	sbuf_make(sb, 4096)
+	if (getcwd(cwd, sizeof(cwd)))
+		sbuf_str(sb, cwd)
+	sbuf_chr(sb, '\n')
+	sbufn_str(sb, path)
+	if (!fd_key || strcmp(fd_key, sb->s)) {
+		fd_prune(1);
+		free(fd_key);
+		fd_key = uc_dup(sb->s);
+		fd_read();
+	}
+	sbuf_cut(sb, 0)
+	fd_seen++;
+	fd_dirty = 0;
+	if (!fd_tabsz || !*fd_slot(path))
+		fd_scan(path);
+	fd_walk(sb, path);
+	fd_prune(0);
 	temp_pos(1, -1, 0, 0);
+	if (sb->s_n) {
+		sb->s[sb->s_n - 1] = '\0';
+		temp_write(1, sb->s);
+		temp_pos(1, -1, 0, 0);
+	}
 	fspos = 0;
-	goto start;
-	while (i > 0) {
-		while ((dirp = readdir(dp)) != NULL) {
-			if (strcmp(dirp->d_name, ".") == 0 ||
-				strcmp(dirp->d_name, "..") == 0)
-				continue;
-			strcpy(ptr, dirp->d_name);
-			if (lstat(cur_dir, &statbuf) >= 0 &&
-					S_ISDIR(statbuf.st_mode)) {
-				start:
-				ptr = file_calc(cur_dir);
-				if ((dp = opendir(cur_dir)) == NULL)
-					return;
-				dps[++i] = dp;
-				ptrs[i] = ptr;
-			}
+	if (fd_dirty)
+		fd_write();
+	sbuf_free(sb)
+}
+
+#define FSBATCH		4096	/* most paths scanned ahead by fssearch */
+#define FSWORKERS	16	/* maximum number of fssearch scanning processes */
+
+struct fsscan {
+	int beg, end, n;	/* paths [beg, end) of tempbufs[1] for n workers */
+	char *lit;		/* a literal in every match or NULL */
+	int litn, ic;		/* literal length and ignoring case */
+};
+
+/* a literal every match of regex kw contains, or NULL */
+static char *fs_literal(char *kw, int ic)
+{
+	char *lit;
+	int n, i;
+	if (kw[0] == '\\' && kw[1] == '<')
+		kw += 2;
+	n = strlen(kw);
+	if (n >= 2 && kw[n - 2] == '\\' && kw[n - 1] == '>')
+		n -= 2;
+	for (i = 0; i < n; i++)
+		if (strchr("\\.[]()*+?{}|^$", kw[i]))
+			return NULL;
+	if (!n)
+		return NULL;
+	lit = emalloc(n + 1);
+	for (i = 0; i < n; i++)
+		lit[i] = ic ? tolower((unsigned char) kw[i]) : kw[i];
+	lit[n] = '\0';
+	return lit;
+}
+
+static char *fs_litfind(char *s, char *e, struct fsscan *fs)
+{
+	int c = (unsigned char) fs->lit[0], C = toupper(c), j;
+	for (e -= fs->litn - 1; s < e; s++) {
+		if (!fs->ic) {
+			if (!(s = memchr(s, c, e - s)))
+				return NULL;
+		} else if ((unsigned char) *s != c && (unsigned char) *s != C)
+			continue;
+		for (j = 1; j < fs->litn; j++)
+			if ((fs->ic ? tolower((unsigned char) s[j]) : s[j]) != fs->lit[j])
+				break;
+		if (j == fs->litn)
+			return s;
+	}
+	return NULL;
+}
+
+/* may a line of the file at path match the search keyword */
+static int fs_scan(char *path, struct fsscan *fs)
+{
+	struct stat st;
+	char *buf, *s, *e, *end;
+	long n = 0, nr;
+	int fd, hit = 0;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+	buf = emalloc(st.st_size + 8);
+	while (n < st.st_size && (nr = read(fd, buf + n, st.st_size - n)) > 0)
+		n += nr;
+	close(fd);
+	memset(buf + n, 0, 8);	/* rset_find() may look past a line end */
+	end = buf + n;
+	for (s = buf; !hit && s < end; s = e + 1) {
+		if (fs->lit) {	/* skip to the line of the next literal */
+			if (!(e = fs_litfind(s, end, fs)))
+				break;
+			while (e > s && e[-1] != '\n')
+				e--;
+			s = e;
 		}
-		closedir(dp);
-		dp = dps[--i];
-		ptr = ptrs[i];
+		if (!(e = memchr(s, '\n', end - s)))
+			e = end;
+		hit = rset_find(xkwdrs, s, 0, NULL, REG_NEWLINE) >= 0;
 	}
+	free(buf);
+	return hit;
+}
+
+static void fs_worker(int w, sbuf *out, void *arg)
+{
+	struct fsscan *fs = arg;
+	int i = fs->beg + (long) (fs->end - fs->beg) * w / fs->n;
+	int end = fs->beg + (long) (fs->end - fs->beg) * (w + 1) / fs->n;
+	for (; i < end; i++) {
+		char *path = lbuf_get(tempbufs[1].lb, i);
+		int len = lbuf_slen(path);
+		path[len] = '\0';
+		sbuf_chr(out, fs_scan(path, fs))
+		path[len] = '\n';
+	}
+}
+
+/* set hits[i - beg] if path i of tempbufs[1] needs searching */
+static void fs_scanall(int beg, int end, char *hits)
+{
+	struct fsscan fs = {beg, end};
+	sbuf *out[FSWORKERS];
+	int i, j, len;
+	char *path;
+	fs.ic = (xkwdrs->regex->flg & REG_ICASE) != 0;
+	fs.lit = fs_literal(regs['/'] ? regs['/'] : "", fs.ic);
+	fs.litn = fs.lit ? strlen(fs.lit) : 0;
+	fs.n = MIN(MIN(cmd_ncpu(), (end - beg + 31) / 32), FSWORKERS);
+	if (fs.n > 1) {
+		if (cmd_fork(fs.n, fs_worker, &fs, out))
+			for (i = 0; i < fs.n; i++)
+				sbuf_cut(out[i], 0)
+	} else {
+		fs.n = 1;
+		sbuf_make(out[0], end - beg + 1)
+		fs_worker(0, out[0], &fs);
+	}
+	memset(hits, 1, end - beg);	/* search paths a worker failed to scan */
+	for (i = 0; i < fs.n; i++) {
+		j = (long) (end - beg) * i / fs.n;
+		len = (long) (end - beg) * (i + 1) / fs.n - j;
+		memcpy(hits + j, out[i]->s, MIN(out[i]->s_n, len));
+		sbuf_free(out[i])
+	}
+	for (i = beg; i < end; i++) {	/* open buffers may differ from their files */
+		path = lbuf_get(tempbufs[1].lb, i);
+		len = lbuf_slen(path);
+		if (path[0] == '.' && path[1] == '/') {
+			path += 2;
+			len -= 2;
+		}
+		if (bufs_find(path, len) >= 0)
+			hits[i - beg] = 1;
+	}
+	free(fs.lit);
 }
 
 #define fssearch() \
@@ -691,14 +1232,24 @@ if (ret && xrow) { \
 if (!vi_search(*row ? 'N' : 'n', cnt, row, off, 0)) \
 	return 1; \
 
+/* only files that may match are opened; the rest are scanned in batches */
 static int fs_search(int cnt, int *row, int *off)
 {
-	char *path;
-	int again = 0, ret, len;
+	char *path, hits[FSBATCH];
+	int again = 0, ret, len, i, n, batch = 16;
+	if (!xkwdrs)
+		return 0;
 	wrap:
 	while (fspos < lbuf_len(tempbufs[1].lb)) {
-		path = lbuf_get(tempbufs[1].lb, fspos++);
-		fssearch()
+		n = MIN(batch, lbuf_len(tempbufs[1].lb) - fspos);
+		fs_scanall(fspos, fspos + n, hits);
+		for (i = 0; i < n; i++) {
+			path = lbuf_get(tempbufs[1].lb, fspos++);
+			if (hits[i]) {
+				fssearch()
+			}
+		}
+		batch = MIN(batch * 2, FSBATCH);
 	}
 	if (fspos == lbuf_len(tempbufs[1].lb) && !again) {
 		fspos = 0;
@@ -710,12 +1261,22 @@ static int fs_search(int cnt, int *row, int *off)
 
 static int fs_searchback(int cnt, int *row, int *off)
 {
-	char *path;
-	int ret, len;
-	while (--fspos >= 0) {
-		path = lbuf_get(tempbufs[1].lb, fspos);
-		fssearch()
+	char *path, hits[FSBATCH];
+	int ret, len, i, n, batch = 16;
+	if (!xkwdrs)
+		return 0;
+	while (fspos > 0) {
+		n = MIN(batch, fspos);
+		fs_scanall(fspos - n, fspos, hits);
+		for (i = n - 1; i >= 0; i--) {
+			path = lbuf_get(tempbufs[1].lb, --fspos);
+			if (hits[i]) {
+				fssearch()
+			}
+		}
+		batch = MIN(batch * 2, FSBATCH);
 	}
+	fspos--;
 	return 0;
 }
 
@@ -849,8 +1410,9 @@ static int vi_motion(int *row, int *off)
 		if (tmpex_buf != ex_buf)
 			ex_pbuf = tmpex_buf;
 		bsync_ret:
-		for (i = xbufcur-1; i >= 0 && bufs[i].mtime == -1; i--)
-			ex_bufpostfix(&bufs[i], 1);
+		for (i = 0; i < xbufcur; i++)	/* opened by ex_edit() */
+			if (!bufs[i].ft)
+				ex_bufpostfix(&bufs[i], 1);
 		syn_setft(ex_ft);
 		return '\\';
 	case TK_CTL('t'):
@@ -1027,22 +1589,24 @@ static void vi_change(int r1, int o1, int r2, int o2, int lnmode)
 {
 	char *region, *pref, *post, *_post;
 	char *ln = lbuf_get(xb, r1);
-	int l1, l2 = 1;
+	int l1, l2 = 1, n, r0 = r1;
 	region = lbuf_region(xb, r1, lnmode ? 0 : o1, r2, lnmode ? -1 : o2);
 	vi_regput(vi_ybuf, region, lnmode);
 	free(region);
 	pref = lnmode ? vi_indents(ln) : uc_subl(ln, 0, o1, &l1);
 	post = _post = lnmode ? uc_dup("\n") : uc_subl(lbuf_get(xb, r2), o2, -1, &l2);
+	term_frame();	/* led_input() draws and commits it */
 	term_pos(r1 - xtop < 0 ? 0 : r1 - xtop, 0);
 	term_room(r1 < xtop ? xtop - xrow : r1 - r2);
 	xrow = r1;
 	if (r1 < xtop)
 		xtop = r1;
-	sbuf *rep = led_input(pref, &post, &xkmap, r1 - (r1 - r2));
+	n = r2 - r1 + 1;
+	sbuf *rep = led_input(pref, &post, &xkmap, &r1, n);
 	xoff = charcount(rep->s, rep->s_n, post, l2 - (post - _post));
-	int tlen = lnmode || !ln ? -1 : lbuf_slen(ln)+1;
+	int tlen = lnmode || !ln || r1 != r0 ? -1 : lbuf_slen(ln)+1;
 	if (rep->s_n != tlen || memcmp(&ln[l1], &rep->s[l1], tlen - l2 - l1))
-		lbuf_edit(xb, rep->s, r1, r2 + 1);
+		lbuf_edit(xb, rep->s, r1, r1 + n);
 	sbuf_free(rep)
 	free(pref);
 	free(_post);
@@ -1183,7 +1747,7 @@ static void vc_insert(int cmd)
 {
 	char *pref, *post, *_post;
 	char *ln = lbuf_get(xb, xrow);
-	int row, cmdo, l2 = 1;
+	int row, row0, cmdo, l2 = 1;
 	if (cmd == 'I')
 		xoff = lbuf_indents(xb, xrow);
 	else if (cmd == 'A')
@@ -1192,11 +1756,13 @@ static void vc_insert(int cmd)
 		xrow++;
 		if (xrow - xtop == xrows) {
 			xtop++;
+			term_frame();
 			vi_drawagain();
+			term_commit();
 		}
 	}
 	xoff = ren_noeol(ln, xoff);
-	row = xrow;
+	row = row0 = xrow;
 	if (cmd == 'a' || cmd == 'A')
 		xoff++;
 	if (ln && ln[0] == '\n')
@@ -1204,13 +1770,14 @@ static void vc_insert(int cmd)
 	cmdo = cmd == 'o' || cmd == 'O';
 	pref = ln && !cmdo ? uc_sub(ln, 0, xoff) : vi_indents(ln);
 	post = _post = ln && !cmdo ? uc_subl(ln, xoff, -1, &l2) : uc_dup("\n");
+	term_frame();	/* led_input() draws and commits it */
 	term_pos(row - xtop, 0);
 	term_room(cmdo);
-	sbuf *rep = led_input(pref, &post, &xkmap, row - cmdo);
-	if (cmdo || post != _post || rep->s_n != (!ln ? -1 : lbuf_slen(ln)+1)) {
+	if (cmdo && !lbuf_len(xb))
+		lbuf_edit(xb, "\n", 0, 0);
+	sbuf *rep = led_input(pref, &post, &xkmap, &row, !cmdo);
+	if (cmdo || post != _post || row != row0 || rep->s_n != (!ln ? -1 : lbuf_slen(ln)+1)) {
 		xoff = charcount(rep->s, rep->s_n, post, l2 - (post - _post));
-		if (cmdo && !lbuf_len(xb))
-			lbuf_edit(xb, "\n", 0, 0);
 		lbuf_edit(xb, rep->s, row, row + !cmdo);
 	}
 	sbuf_free(rep)
@@ -1405,6 +1972,77 @@ static void vi_argcmd(int arg, char cmd)
 	term_push(str, cs - str + 1);
 }
 
+/* highlight every instance of the word(s) under the cursor (hlw) */
+static void vi_hlword(void)
+{
+	static char *word;
+	char *beg, *end;
+	int hl;
+	if (!xhlw) {
+		if (word) {
+			led_overlay(1, -1, 0, 0, 0);
+			free(word);
+			word = NULL;
+			vi_mod |= 1;
+		}
+		return;
+	}
+	if (vi_wordspan(xb, xrow, xoff, xhlw, &beg, &end) || (hl = syn_findhl(1)) < 0)
+		return;
+	/* :ft drops the overlays */
+	if (!word || strncmp(word, beg, end - beg) || word[end - beg] ||
+			(*word && !led_overlays(1))) {
+		free(word);
+		word = emalloc(end - beg + 1);
+		memcpy(word, beg, end - beg);
+		word[end - beg] = '\0';
+		led_overlay(1, -1, 0, 0, 0);
+		led_overlayw(1, word, xhlw == 1, hls[hl].att[0]);
+		vi_mod |= 1;
+	}
+}
+
+/* highlight the cursor line (hll) */
+static void vi_hlline(void)
+{
+	int hl = syn_findhl(2);
+	led_overlay(2, -1, 0, 0, 0);
+	if (xhll && hl >= 0)
+		led_overlay(2, xrow, 0, -1, hls[hl].att[0]);
+}
+
+/* highlight the bracket at or after the cursor and its pair (hlp) */
+static void vi_hlpair(int *rows)
+{
+	static int pair[4] = {-1, -1, -1, -1};	/* rows and offsets of the pair */
+	int cur[4] = {-1, -1, -1, -1};
+	int row = xrow, off = xoff, hl, i, j, n = 0;
+	char *s = lbuf_get(xb, xrow);
+	led_overlay(3, -1, 0, 0, 0);
+	if (xhlp && s && (hl = syn_findhl(3)) >= 0 && !lbuf_pair(xb, &row, &off)) {
+		s = uc_chr(s, xoff);
+		s += strcspn(s, "()[]{}");
+		cur[0] = xrow;
+		cur[1] = uc_off(lbuf_get(xb, xrow), s - lbuf_get(xb, xrow));
+		cur[2] = row;
+		cur[3] = off;
+		i = !!strchr(")]}", *s);
+		led_overlay(3, cur[0], cur[1], cur[1] + 1, hls[hl].att[1 + i]);
+		led_overlay(3, cur[2], cur[3], cur[3] + 1, hls[hl].att[2 - i]);
+	}
+	if (memcmp(cur, pair, sizeof(cur))) {
+		int cand[4] = {pair[0], pair[2], cur[0], cur[2]};
+		for (i = 0; i < 4; i++) {
+			for (j = 0; j < n && rows[j] != cand[i]; j++);
+			if (cand[i] >= 0 && j == n)
+				rows[n++] = cand[i];
+		}
+		memcpy(pair, cur, sizeof(cur));
+	}
+	for (; n < 4; n++)
+		rows[n] = -1;
+}
+
 void vi(int init)
 {
 	int mark, kmap = 0;
@@ -1412,9 +2050,11 @@ void vi(int init)
 	if (init) {
 		xtop = MAX(0, xrow - xrows / 2);
 		vi_col = vi_off2col(xb, xrow, xoff);
+		term_frame();
 		vi_drawagain();
 		vi_drawmsg();
 		term_pos(xrow - xtop, led_pos(lbuf_get(xb, xrow), vi_col));
+		term_commit();
 	}
 	while (!xquit) {
 		int nrow = xrow;
@@ -1422,7 +2062,8 @@ void vi(int init)
 		int otop = xtop;
 		int oleft = xleft;
 		int orow = xrow;
-		int mv, n;
+		int mv, n, i, rows[6];
+		long tm;
 		term_cmd(&n);
 		vi_arg2 = 0;
 		vi_mod = 0;
@@ -1439,11 +2080,14 @@ void vi(int init)
 				vi_status = xrows;
 				vc_status();
 			}
+			term_frame();
 			vi_drawrow(otop + xrows - 1);
 		}
 		if (!vi_ybuf)
 			vi_ybuf = vi_yankbuf();
 		mv = vi_motion(&nrow, &noff);
+		if (mv && term_keyt)
+			term_time(PF_MOT, term_keyt);
 		if (mv > 0) {
 			if (noff < 0 && !strchr("jk", mv))
 				noff = lbuf_indents(xb, nrow);
@@ -1481,12 +2125,12 @@ void vi(int init)
 			case TK_CTL('b'):
 				vi_scrollbackward(MAX(1, vi_arg1) * (xrows - 1));
 				xoff = lbuf_indents(xb, xrow);
-				vi_mod |= 1;
+				vi_col = vi_off2col(xb, xrow, xoff);
 				break;
 			case TK_CTL('f'):
 				vi_scrollforward(MAX(1, vi_arg1) * (xrows - 1));
 				xoff = lbuf_indents(xb, xrow);
-				vi_mod |= 1;
+				vi_col = vi_off2col(xb, xrow, xoff);
 				break;
 			case TK_CTL('e'):
 				vi_scrolley = vi_arg1 ? vi_arg1 : vi_scrolley;
@@ -1512,7 +2156,7 @@ void vi(int init)
 				if (xtop > 0)
 					xtop = MAX(0, xtop - n);
 				xoff = lbuf_indents(xb, xrow);
-				vi_mod |= 1;
+				vi_col = vi_off2col(xb, xrow, xoff);
 				break;
 			case TK_CTL('d'):
 				if (xrow == lbuf_len(xb) - 1)
@@ -1524,7 +2168,7 @@ void vi(int init)
 				if (xtop < lbuf_len(xb) - xrows)
 					xtop = MIN(lbuf_len(xb) - xrows, xtop + n);
 				xoff = lbuf_indents(xb, xrow);
-				vi_mod |= 1;
+				vi_col = vi_off2col(xb, xrow, xoff);
 				break;
 			case TK_CTL('z'):
 				term_pos(xrows, 0);
@@ -1548,6 +2192,7 @@ void vi(int init)
 			case TK_CTL('_'): /* note: this is also ^7 per ascii */
 				if (vi_arg1 > 0)
 					goto switchbuf;
+				term_frame();
 				term_pos(xrows, led_pos(vi_msg, 0));
 				xleft = 0;
 				ex_exec("b");
@@ -1661,7 +2306,9 @@ void vi(int init)
 					break;
 				case 't': {
 					strcpy(vi_msg, "arg2:(0|#)");
+					term_frame();
 					vi_drawmsg();
+					term_commit();
 					cs = vi_curword(xb, xrow, xoff, vi_prefix(), '|');
 					char buf[cs ? strlen(cs)+30 : 30];
 					strcpy(buf, ".,.+");
@@ -1822,7 +2469,8 @@ void vi(int init)
 					xkmap_alt = k - '0';
 					break;
 				}
-				vi_mod |= 1;
+				if (k != '\n' && k != '.' && k != '-')
+					vi_mod |= 1;
 				break;
 			case 'g':
 				k = vi_read();
@@ -1919,87 +2567,34 @@ void vi(int init)
 			xleft = vi_col < xcols ? 0 : vi_col - xcols / 2;
 		n = led_pos(lbuf_get(xb, xrow), ren_cursor(lbuf_get(xb, xrow), vi_col));
 		vi_wait();
-		if (xhlw) {
-			static char *word;
-			if ((cs = vi_curword(xb, xrow, xoff, xhlw, 0))) {
-				if (!word || strcmp(word, cs)) {
-					syn_addhl(cs, 1, 1);
-					free(word);
-					word = cs;
-					vi_mod |= 1;
-				}
-			}
-		}
-		if (xhlp && (cs = lbuf_get(xb, xrow))) {
-			char pairs[] = "{([})]{([})]";
-			cs = uc_chr(cs, xoff);
-			int start = uc_off(cs, strcspn(cs, "{([})]"));
-			int ch = dstrlen(pairs, *uc_chr(cs, start));
-			if (ch < 9) {
-				static sbuf *sb;
-				char buf[100];
-				int pos = xleft ? ren_off(lbuf_get(xb, xrow), xleft) : 0;
-				start += xoff - pos;
-				int row = xrow, off = start + pos;
-				if (!lbuf_pair(xb, &row, &off)) {
-					off -= pos;
-					if (sb)
-						sbuf_free(sb)
-					sbuf_make(sb, 128)
-					if (off && row == xrow && off - start - 1 < 0)
-					{
-						ch += 3;
-						swap(&start, &off);
-					}
-					if (start) {
-						sbuf_str(sb, "^.{")
-						itoa(start, buf);
-						sbuf_str(sb, buf)
-						sbuf_str(sb, "}(\\{)")
-					} else
-						sbuf_str(sb, "^(\\{)")
-					sb->s[sb->s_n-2] = pairs[ch];
-					if (off && row == xrow) {
-						sbuf_str(sb, ".{")
-						itoa(abs(off - start - 1), buf);
-						sbuf_str(sb, buf)
-						sbuf_str(sb, "}(\\})")
-					} else if (off) {
-						sbuf_str(sb, "|^.{")
-						itoa(off, buf);
-						sbuf_str(sb, buf)
-						sbuf_str(sb, "}(\\})")
-					} else
-						sbuf_str(sb, "|^(\\})")
-					sb->s[sb->s_n-2] = pairs[ch+3];
-					sbuf_null(sb)
-					syn_addhl(sb->s, 3, 1);
-					vi_mod |= 1;
-				}
-			}
-		}
+		vi_hlword();
+		vi_hlline();
+		vi_hlpair(rows);
+		if (term_keyt)
+			term_time(PF_CMD, term_keyt);
+		tm = term_clock();
 		syn_reloadft();
-		term_record = 1;
+		term_time(PF_SYN, tm);
+		term_frame();
+		tm = term_clock();
 		if (vi_mod & 1 || vi_mod & 4 || xleft != oleft)
 			vi_drawagain();
-		else if (xtop != otop)
-			vi_drawupdate(otop);
-		if (xhll) {
-			syn_blockhl = 0;
-			if (xrow != orow && orow >= xtop && orow < xtop + xrows)
-				if (!vi_mod)
-					vi_drawrow(orow);
-			syn_addhl("^.+", 2, 1);
-			syn_reloadft();
-			vi_drawrow(xrow);
-			syn_addhl(NULL, 2, 1);
-			syn_reloadft();
-		} else if (vi_mod == 2) {
-			syn_blockhl = 0;
-			vi_drawrow(xrow);
+		else {
+			if (xtop != otop)
+				vi_drawupdate(otop);
+			rows[4] = xhll && xrow != orow && !vi_mod ? orow : -1;
+			rows[5] = vi_mod == 2 || (xhll && (xrow != orow || vi_mod)) ? xrow : -1;
+			for (i = 0; i < LEN(rows); i++) {
+				for (mv = i + 1; mv < LEN(rows) && rows[mv] != rows[i]; mv++);
+				if (mv == LEN(rows) && rows[i] >= xtop && rows[i] < xtop + xrows) {
+					syn_blockhl = 0;
+					vi_drawrow(rows[i]);
+				}
+			}
 		}
 		vi_drawmsg();
 		term_pos(xrow - xtop, n);
+		term_time(PF_DRAW, tm);
 		term_commit();
 		lbuf_modified(xb);
 	}
@@ -2023,6 +2618,8 @@ static int setup_signals(void) {
 int main(int argc, char *argv[])
 {
 	int i, j;
+	long bench = 0;
+	char *r;
 	if (!setup_signals())
 		return EXIT_FAILURE;
 	dir_init();
@@ -2041,13 +2638,17 @@ int main(int argc, char *argv[])
 				xvis |= 4;
 			else if (argv[i][j] == 'v')
 				xvis &= ~4;
+			else if (argv[i][j] == 'b')
+				term_null = 1;
 			else {
 				fprintf(stderr, "Unknown option: -%c\n", argv[i][j]);
-				fprintf(stderr, "Usage: %s [-esv] [file ...]\n", argv[0]);
+				fprintf(stderr, "Usage: %s [-besv] [file ...]\n", argv[0]);
 				return EXIT_FAILURE;
 			}
 		}
 	}
+	if (term_null)
+		bench = term_clock();
 	term_init();
 	ex_init(argv + i, argc - i);
 	if (xvis & 4)
@@ -2055,12 +2656,17 @@ int main(int argc, char *argv[])
 	else
 		vi(1);
 	term_done();
-	if (xvis & 4)
-		return EXIT_SUCCESS;
-	if (xquit == 2) {
-		term_pos(xrows - 1, 0);
-		term_kill();
-	} else
-		term_clean();
+	if (!(xvis & 4)) {
+		if (xquit == 2) {
+			term_pos(xrows - 1, 0);
+			term_kill();
+		} else
+			term_clean();
+	}
+	if (term_null) {
+		r = ex_perf();
+		fprintf(stderr, "time: %ldus\n%s", term_clock() - bench, r);
+		free(r);
+	}
 	return EXIT_SUCCESS;
 }
@@ -131,18 +131,21 @@ char *lbuf_cp(struct lbuf *lbuf, int beg, int end);
 char *lbuf_get(struct lbuf *lbuf, int pos);
 char **lbuf_buf(struct lbuf *lb);
 int lbuf_len(struct lbuf *lbuf);
+int lbuf_stamp(struct lbuf *lb);
 void lbuf_emark(struct lbuf *lb, int hist_n, int beg, int end);
 int lbuf_opt(struct lbuf *lb, char *buf, int pos, int n_del);
 void lbuf_mark(struct lbuf *lbuf, int mark, int pos, int off);
 int lbuf_jump(struct lbuf *lbuf, int mark, int *pos, int *off);
+int lbuf_marked(struct lbuf *lb, int beg, int end);
 int lbuf_undo(struct lbuf *lbuf);
 int lbuf_redo(struct lbuf *lbuf);
 int lbuf_modified(struct lbuf *lb);
 void lbuf_saved(struct lbuf *lb, int clear);
 int lbuf_indents(struct lbuf *lb, int r);
 int lbuf_eol(struct lbuf *lb, int r);
-void lbuf_globset(struct lbuf *lb, int pos, int dep);
-int lbuf_globget(struct lbuf *lb, int pos, int dep);
+void lbuf_globset(struct lbuf *lb, int beg, int end, int dep);
+int lbuf_globnext(struct lbuf *lb, int pos, int dep);
+void lbuf_globclear(struct lbuf *lb, int dep);
 int lbuf_findchar(struct lbuf *lb, char *cs, int cmd, int n, int *r, int *o);
 int lbuf_search(struct lbuf *lb, rset *re, int dir, int *r,
 			int ln_n, int *o, int *len, int skip);
@@ -158,6 +161,7 @@ typedef struct {
 	char **ren_lastchrs;
 	char *ren_laststr;	/* to prevent redundant computations, ensure pointer uniqueness */
 	int *ren_lastpos;
+	char (*ren_lastshp)[4];	/* shaped forms of ren_lastchrs, computed on demand */
 	int ren_lastn;
 } ren_state;
 extern ren_state *rstate;
@@ -170,7 +174,7 @@ int ren_cursor(char *s, int pos);
 int ren_noeol(char *s, int p);
 int ren_off(char *s, int pos);
 int ren_region(char *s, int c1, int c2, int *l1, int *l2, int closed);
-char *ren_translate(char *s, char *ln);
+char *ren_translate(char **chrs, int o);
 int ren_cwid(char *s, int pos);
 /* text direction */
 int dir_context(char *s);
@@ -195,6 +199,7 @@ char *syn_filetype(char *path);
 int syn_merge(int old, int new);
 void syn_reloadft(void);
 int syn_addhl(char *reg, int func, int reload);
+int syn_findhl(int func);
 void syn_init(void);
 
 /* uc.c utf-8 helper functions */
@@ -216,6 +221,7 @@ else \
 	dst = 0; \
 
 int uc_wid(int c);
+int uc_ascii(char *s, int n, int notab);
 int uc_slen(char *s);
 char *uc_chr(char *s, int off);
 int uc_off(char *s, int off);
@@ -235,11 +241,29 @@ char *uc_prev(char *beg, char *s);
 char *uc_beg(char *beg, char *s);
 char *uc_end(char *s);
 char *uc_shape(char *beg, char *s);
+void uc_shapeln(char **chrs, int n, char (*shp)[4]);
 char *uc_lastline(char *s);
 
 /* term.c managing the terminal */
 extern sbuf *term_sbuf;
 extern int term_record;
+extern int term_null;
+extern long term_nwrites, term_nbytes;
+extern long term_nframes, term_fwrites, term_fbytes;
+/* timed phases */
+#define PF_CMD		0	/* from reading a key to drawing */
+#define PF_SYN		1	/* syn_reloadft() */
+#define PF_DRAW		2	/* updating the screen */
+#define PF_REN		3	/* led_render() */
+#define PF_COMMIT	4	/* term_commit() */
+#define PF_KEY		5	/* from reading a key to painting */
+#define PF_MOT		6	/* from reading a motion's last key to moving */
+#define PF_CNT		7
+#define PF_BKT		24	/* histogram buckets */
+extern long term_hist[PF_CNT][PF_BKT];
+extern long term_keyt;
+long term_clock(void);
+void term_time(int phase, long beg);
 extern int xrows, xcols;
 extern unsigned int ibuf_pos, ibuf_cnt, icmd_pos;
 void term_init(void);
@@ -251,12 +275,15 @@ void term_chr(int ch);
 void term_pos(int r, int c);
 void term_kill(void);
 void term_room(int n);
+void term_region(int top, int bot);
 int term_rows(void);
 int term_cols(void);
 int term_read(void);
+void term_frame(void);
 void term_commit(void);
-char *term_att(int att);
+char *term_att(int att, int old);
 void term_push(char *s, unsigned int n);
+char *term_paste(int *n);
 char *term_cmd(int *n);
 #define term_exec(s, n, precode, postcode) \
 { \
@@ -275,6 +302,8 @@ char *term_cmd(int *n);
 /* process management */
 char *cmd_pipe(char *cmd, char *ibuf, int oproc);
 int cmd_exec(char *cmd);
+int cmd_ncpu(void);
+int cmd_fork(int n, void (*fn)(int i, sbuf *sb, void *arg), void *arg, sbuf **out);
 char *xgetenv(char* q[]);
 
 #define TK_CTL(x)	((x) & 037)
@@ -283,8 +312,12 @@ char *xgetenv(char* q[]);
 
 /* led.c line-oriented input and output */
 char *led_prompt(char *pref, char *post, char *insert, int *kmap);
-sbuf *led_input(char *pref, char **post, int *kmap, int row);
+sbuf *led_input(char *pref, char **post, int *kmap, int *row, int nrow);
 void led_render(char *s0, int row, int cbeg, int cend);
+void led_overlay(int id, int row, int beg, int end, int att);
+void led_overlayw(int id, char *w, int whole, int att);
+int led_overlays(int id);
+extern int led_ovlrow;
 #define led_print(msg, row) led_render(msg, row, xleft, xleft + xcols)
 #define led_reprint(msg, row) { rstate->ren_laststr = NULL; led_print(msg, row); }
 char *led_read(int *kmap, int c);
@@ -298,6 +331,7 @@ struct buf {
 	struct lbuf *lb;
 	int plen, row, off, top;
 	long mtime;			/* modification time */
+	int lru;			/* last switch to it, for eviction */
 	signed char td;			/* text direction */
 };
 extern int xbufcur;
@@ -333,12 +367,14 @@ int ex_exec(const char *ln);
 char *ex_read(char *msg);
 void ex_print(char *line);
 void ex_show(char *msg);
+char *ex_perf(void);
 void ex_init(char **files, int n);
 void ex_bufpostfix(struct buf *p, int clear);
 int ex_krs(rset **krs, int *dir);
 void ex_krsset(char *kwd, int dir);
 int ex_edit(const char *path, int len);
 void ec_bufferi(int id);
+int bufs_find(const char *path, int len);
 void bufs_switch(int idx);
 #define bufs_switchwft(idx) \
 { if (&bufs[idx] != ex_buf) { bufs_switch(idx); syn_setft(ex_ft); } } \